@@ -0,0 +1,175 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+//---------------------------------------------------------------------------
+// llvm-coverage-to-html converter
+// (c) 2017 Thomas Neumann
+// SPDX-License-Identifier: GPL-2.0-or-later
+//---------------------------------------------------------------------------
+// The binary coverage export. All values are stored little-endian:
+//
+//   Header
+//   FileEntry[fileCount]                  sorted by path
+//   per file: uint64_t executable[words]  bit n set if line n is executable
+//             uint64_t hit[words]         bit n set if line n was hit
+//   the paths, concatenated
+//
+// with words = (lineLimit + 63) / 64.
+//---------------------------------------------------------------------------
+namespace binarycoverage {
+//---------------------------------------------------------------------------
+/// The magic number
+static constexpr char magic[8] = {'L', 'C', 'O', 'V', '2', 'B', 'I', 'N'};
+/// The format version
+static constexpr uint32_t version = 1;
+static_assert(std::endian::native == std::endian::little, "the binary coverage export is little-endian");
+//---------------------------------------------------------------------------
+/// The file header
+struct Header {
+   char magic[8];
+   uint32_t version;
+   uint32_t fileCount;
+   uint64_t fileTableOffset;
+   uint64_t pathsOffset;
+};
+//---------------------------------------------------------------------------
+/// The description of a source file
+struct FileEntry {
+   /// The position of the bitmaps
+   uint64_t bitmapOffset;
+   /// The position of the path within the paths
+   uint32_t pathOffset, pathLength;
+   /// All line numbers are below this limit
+   uint32_t lineLimit;
+   /// Statistics
+   uint32_t hitLines, executableLines;
+   /// The number of lines of the source file, 0 if unknown
+   uint32_t lineCount;
+};
+//---------------------------------------------------------------------------
+/// The state of a line
+enum class LineState { Unknown, NotExecutable, Missed, Hit };
+//---------------------------------------------------------------------------
+class Reader {
+   private:
+   /// The mapping
+   const char* data = nullptr;
+   /// The size
+   size_t size = 0;
+   /// The header
+   const Header* header = nullptr;
+   /// The files
+   const FileEntry* files = nullptr;
+
+   /// Check if a bit is set
+   bool testBit(uint64_t offset, unsigned bit) const {
+      uint64_t word;
+      memcpy(&word, data + offset + (bit / 64) * 8, 8);
+      return (word >> (bit % 64)) & 1;
+   }
+
+   public:
+   /// Constructor
+   Reader() = default;
+   /// Destructor
+   ~Reader() {
+      if (size) munmap(const_cast<char*>(data), size);
+   }
+   Reader(const Reader&) = delete;
+   Reader& operator=(const Reader&) = delete;
+
+   /// Open an export. Returns false if the file cannot be read or is malformed
+   bool open(const std::string& fileName);
+
+   /// The number of files
+   unsigned getFileCount() const { return header ? header->fileCount : 0; }
+   /// The path of a file
+   std::string_view getPath(unsigned file) const { return {data + header->pathsOffset + files[file].pathOffset, files[file].pathLength}; }
+   /// The description of a file
+   const FileEntry& getFile(unsigned file) const { return files[file]; }
+   /// Find a file by path. Returns -1 if not found
+   int findFile(std::string_view path) const;
+   /// The state of a line
+   LineState getLineState(unsigned file, unsigned line) const;
+};
+//---------------------------------------------------------------------------
+inline bool Reader::open(const std::string& fileName)
+// Open an export
+{
+   int fd = ::open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0)
+      return false;
+   struct stat s;
+   if ((fstat(fd, &s) != 0) || (static_cast<size_t>(s.st_size) < sizeof(Header))) {
+      ::close(fd);
+      return false;
+   }
+   void* mapping = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   ::close(fd);
+   if (mapping == MAP_FAILED)
+      return false;
+   data = static_cast<const char*>(mapping);
+   size = s.st_size;
+
+   // Validate the layout, so that lookups do not need any checks
+   header = reinterpret_cast<const Header*>(data);
+   if ((memcmp(header->magic, magic, sizeof(magic)) != 0) || (header->version != version) || (header->fileTableOffset % 8) || (header->fileTableOffset > size) || ((size - header->fileTableOffset) / sizeof(FileEntry) < header->fileCount) || (header->pathsOffset > size)) {
+      header = nullptr;
+      return false;
+   }
+   files = reinterpret_cast<const FileEntry*>(data + header->fileTableOffset);
+   for (unsigned index = 0; index < header->fileCount; ++index) {
+      auto& f = files[index];
+      uint64_t bitmapSize = 2 * 8 * ((static_cast<uint64_t>(f.lineLimit) + 63) / 64);
+      if ((f.bitmapOffset > size) || (size - f.bitmapOffset < bitmapSize) || (static_cast<uint64_t>(f.pathOffset) + f.pathLength > size - header->pathsOffset)) {
+         header = nullptr;
+         return false;
+      }
+   }
+   return true;
+}
+//---------------------------------------------------------------------------
+inline int Reader::findFile(std::string_view path) const
+// Find a file by path
+{
+   unsigned lower = 0, upper = getFileCount();
+   while (lower < upper) {
+      unsigned middle = lower + (upper - lower) / 2;
+      auto p = getPath(middle);
+      if (p < path) {
+         lower = middle + 1;
+      } else if (p > path) {
+         upper = middle;
+      } else {
+         return middle;
+      }
+   }
+   return -1;
+}
+//---------------------------------------------------------------------------
+inline LineState Reader::getLineState(unsigned file, unsigned line) const
+// The state of a line
+{
+   if (file >= getFileCount())
+      return LineState::Unknown;
+   auto& f = files[file];
+   if ((!line) || (f.lineCount && (line > f.lineCount)))
+      return LineState::Unknown;
+   if (line >= f.lineLimit)
+      return LineState::NotExecutable;
+   uint64_t words = (static_cast<uint64_t>(f.lineLimit) + 63) / 64;
+   if (!testBit(f.bitmapOffset, line))
+      return LineState::NotExecutable;
+   return testBit(f.bitmapOffset + 8 * words, line) ? LineState::Hit : LineState::Missed;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
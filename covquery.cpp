@@ -0,0 +1,81 @@
+#include "binarycoverage.hpp"
+#include <charconv>
+#include <iostream>
+#include <string>
+#include <string_view>
+//---------------------------------------------------------------------------
+// llvm-coverage-to-html converter
+// (c) 2017 Thomas Neumann
+// SPDX-License-Identifier: GPL-2.0-or-later
+//---------------------------------------------------------------------------
+// Query a binary coverage export written by llvmcov2html --binary-export
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+static int findFile(const binarycoverage::Reader& reader, string_view path)
+// Find a file by its full path or by a unique path suffix. Returns -1 for unknown and -2 for ambiguous files
+{
+   int file = reader.findFile(path);
+   if (file >= 0)
+      return file;
+   for (unsigned index = 0, limit = reader.getFileCount(); index < limit; ++index) {
+      auto p = reader.getPath(index);
+      if ((p.size() > path.size()) && (p.ends_with(path)) && (p[p.size() - path.size() - 1] == '/')) {
+         if (file >= 0)
+            return -2;
+         file = index;
+      }
+   }
+   return file;
+}
+//---------------------------------------------------------------------------
+int main(int argc, char** argv) {
+   if (argc < 2) {
+      cerr << "usage: " << argv[0] << " coverage.bin [file:line...]" << endl;
+      cerr << "without queries all files are listed with their hit and executable lines" << endl;
+      cerr << "the exit code is 0 if all queried lines were hit, 1 if not, and 2 on errors" << endl;
+      return 2;
+   }
+   binarycoverage::Reader reader;
+   if (!reader.open(argv[1])) {
+      cerr << "unable to read " << argv[1] << endl;
+      return 2;
+   }
+
+   // List all files
+   if (argc == 2) {
+      for (unsigned index = 0, limit = reader.getFileCount(); index < limit; ++index) {
+         auto& f = reader.getFile(index);
+         cout << reader.getPath(index) << " " << f.hitLines << "/" << f.executableLines << "\n";
+      }
+      return 0;
+   }
+
+   // Answer the queries
+   bool allHit = true;
+   for (int index = 2; index < argc; ++index) {
+      string_view query = argv[index];
+      auto split = query.rfind(':');
+      unsigned line = 0;
+      auto parsed = (split == string_view::npos) ? from_chars_result{query.data(), errc::invalid_argument} : from_chars(query.data() + split + 1, query.data() + query.size(), line);
+      if ((parsed.ec != errc()) || (parsed.ptr != query.data() + query.size())) {
+         cerr << "invalid query " << query << ", expected file:line" << endl;
+         return 2;
+      }
+      int file = findFile(reader, query.substr(0, split));
+      const char* result = (file == -2) ? "ambiguous file" : "unknown file";
+      if (file >= 0) {
+         switch (reader.getLineState(file, line)) {
+            case binarycoverage::LineState::Unknown: result = "unknown line"; break;
+            case binarycoverage::LineState::NotExecutable: result = "not executable"; break;
+            case binarycoverage::LineState::Missed: result = "missed"; break;
+            case binarycoverage::LineState::Hit: result = "hit"; break;
+         }
+      }
+      if (string_view(result) != "hit")
+         allHit = false;
+      cout << query << " " << result << "\n";
+   }
+   return allHit ? 0 : 1;
+}
+//---------------------------------------------------------------------------
@@ -1,12 +1,37 @@
+#include "binarycoverage.hpp"
+#include <llvm/Demangle/Demangle.h>
 #include <llvm/ProfileData/Coverage/CoverageMapping.h>
+#include <llvm/ProfileData/InstrProfReader.h>
+#include <llvm/ProfileData/InstrProfWriter.h>
+#include <llvm/Support/GlobPattern.h>
+#include <llvm/Support/Regex.h>
 #include <llvm/Support/VirtualFileSystem.h>
-#include <fstream>
+#include <llvm/Support/xxhash.h>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <deque>
 #include <iostream>
 #include <map>
-#include <regex>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 //---------------------------------------------------------------------------
 // llvm-coverage-to-html converter
 // (c) 2017 Thomas Neumann
@@ -14,18 +39,329 @@
 //---------------------------------------------------------------------------
 using namespace std;
 //---------------------------------------------------------------------------
-static unique_ptr<llvm::coverage::CoverageMapping> loadCoverage(const string& objectFile, const string& profileFile) {
-   auto fs = llvm::vfs::getRealFileSystem();
-   llvm::StringRef objectFiles[1] = {objectFile};
-   auto res = llvm::coverage::CoverageMapping::load(objectFiles, profileFile, *fs);
-   if (!res) {
-      cerr << "unable to load profile" << endl;
-      exit(1);
+/// A short string on the stack, used to format numbers without allocations. Overlong content is truncated
+class ShortString {
+   private:
+   /// The characters
+   char data[32];
+   /// The length
+   unsigned length = 0;
+
+   public:
+   /// Append a string
+   ShortString& operator<<(string_view s) {
+      s = s.substr(0, sizeof(data) - length);
+      memcpy(data + length, s.data(), s.size());
+      length += s.size();
+      return *this;
+   }
+   /// Append a character
+   ShortString& operator<<(char c) {
+      if (length < sizeof(data)) data[length++] = c;
+      return *this;
+   }
+   /// Append a number
+   ShortString& operator<<(uint64_t v) {
+      length = to_chars(data + length, data + sizeof(data), v).ptr - data;
+      return *this;
+   }
+   /// Append a number
+   ShortString& operator<<(unsigned v) { return *this << static_cast<uint64_t>(v); }
+
+   /// The string
+   operator string_view() const { return {data, length}; }
+};
+//---------------------------------------------------------------------------
+static uint64_t getMicroseconds()
+// The time since the first call in microseconds, used for --stats and --trace
+{
+   static const auto start = chrono::steady_clock::now();
+   return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+}
+//---------------------------------------------------------------------------
+/// A background thread that performs the writes of output files, so that the workers continue rendering while their data goes to disk
+class AsyncWriter {
+   public:
+   /// The size of the buffers
+   static constexpr size_t bufferSize = 1 << 20;
+   /// A write request
+   struct Request {
+      /// The file, it is closed after the write if requested
+      int fd;
+      bool close;
+      /// The data
+      unique_ptr<char[]> buffer;
+      size_t size;
+      /// The file name for error messages
+      string fileName;
+   };
+
+   private:
+   /// The maximum number of pending requests, bounds the memory consumption
+   static constexpr size_t maxPending = 32;
+
+   /// The lock
+   mutex lock;
+   /// Signals new requests and free slots
+   condition_variable requestAvailable, slotAvailable;
+   /// The pending requests
+   deque<Request> requests;
+   /// Buffers for reuse
+   vector<unique_ptr<char[]>> freeBuffers;
+   /// Shut down once all requests are done?
+   bool shutdown = false;
+   /// The writer thread
+   thread writer;
+
+   /// Process the requests
+   void run();
+
+   public:
+   /// Constructor
+   AsyncWriter() : writer([this]() { run(); }) {}
+   /// Destructor. Waits for all pending writes
+   ~AsyncWriter();
+
+   /// Queue a write. Blocks if too many writes are pending
+   void submit(Request request);
+   /// Get an empty buffer
+   unique_ptr<char[]> getBuffer();
+
+   /// The time spent in the writes of all async writers, in microseconds, for --stats
+   static inline atomic<uint64_t> totalWriteTime = 0;
+};
+//---------------------------------------------------------------------------
+class OutputFile {
+   private:
+   /// The size of the write buffer, buffers are exchanged with the async writer
+   static constexpr size_t bufferSize = AsyncWriter::bufferSize;
+
+   /// The file name
+   string fileName;
+   /// The file descriptor
+   int fd;
+   /// The write buffer
+   unique_ptr<char[]> buffer;
+   /// The number of buffered bytes
+   size_t used = 0;
+   /// The number of bytes already written to the file
+   uint64_t written = 0;
+   /// The writer thread, if the writes are asynchronous
+   AsyncWriter* asyncWriter;
+
+   /// Write the buffer and some extra data to the file
+   void writeOut(string_view extra);
+   /// Report a write error
+   [[noreturn]] void fail();
+
+   public:
+   /// The number of bytes written to all files, for --stats
+   static inline atomic<uint64_t> totalWritten = 0;
+
+   /// Constructor. With an async writer all writes are performed in the background
+   explicit OutputFile(string fileName, AsyncWriter* asyncWriter = nullptr);
+   /// Destructor
+   ~OutputFile();
+   OutputFile(const OutputFile&) = delete;
+   OutputFile& operator=(const OutputFile&) = delete;
+
+   /// Write a string
+   OutputFile& operator<<(string_view s) {
+      if (s.size() <= bufferSize - used) {
+         memcpy(buffer.get() + used, s.data(), s.size());
+         used += s.size();
+      } else {
+         writeOut(s);
+      }
+      return *this;
+   }
+   /// Write a character
+   OutputFile& operator<<(char c) {
+      if (used == bufferSize) writeOut({});
+      buffer[used++] = c;
+      return *this;
+   }
+   /// Write a number
+   OutputFile& operator<<(uint64_t v) { return *this << string_view(ShortString() << v); }
+   /// Write a number
+   OutputFile& operator<<(unsigned v) { return *this << static_cast<uint64_t>(v); }
+   /// Write a string right-aligned within a field of the given width (at most 16)
+   void writeRightAligned(string_view s, unsigned width) {
+      static constexpr string_view spaces = "                ";
+      if (s.size() < width) *this << spaces.substr(0, width - s.size());
+      *this << s;
+   }
+
+   /// The current position within the file
+   uint64_t tell() const { return written + used; }
+   /// Flush the buffer and close the file
+   void close();
+};
+//---------------------------------------------------------------------------
+OutputFile::OutputFile(string fileName, AsyncWriter* asyncWriter)
+   : fileName(move(fileName)), buffer(asyncWriter ? asyncWriter->getBuffer() : unique_ptr<char[]>(new char[bufferSize])), asyncWriter(asyncWriter)
+// Constructor
+{
+   fd = open(this->fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+   if (fd < 0) fail();
+}
+//---------------------------------------------------------------------------
+OutputFile::~OutputFile()
+// Destructor
+{
+   if (fd >= 0)
+      close();
+}
+//---------------------------------------------------------------------------
+void OutputFile::close()
+// Flush the buffer and close the file
+{
+   if (asyncWriter) {
+      asyncWriter->submit({fd, true, move(buffer), used, fileName});
+      written += used;
+      used = 0;
+      fd = -1;
+      return;
+   }
+   if (used) writeOut({});
+   if (::close(fd) != 0) fail();
+   fd = -1;
+}
+//---------------------------------------------------------------------------
+void OutputFile::fail()
+// Report a write error
+{
+   cerr << "unable to write " << fileName << endl;
+   exit(1);
+}
+//---------------------------------------------------------------------------
+void OutputFile::writeOut(string_view extra)
+// Write the buffer and some extra data to the file
+{
+   if (asyncWriter) {
+      // Hand the buffer over to the writer, the extra data is copied in pieces
+      while (true) {
+         size_t step = min(extra.size(), bufferSize - used);
+         memcpy(buffer.get() + used, extra.data(), step);
+         used += step;
+         extra.remove_prefix(step);
+         if (extra.empty() && (used < bufferSize))
+            return;
+         written += used;
+         asyncWriter->submit({fd, false, move(buffer), used, fileName});
+         buffer = asyncWriter->getBuffer();
+         used = 0;
+         if (extra.empty())
+            return;
+      }
+   }
+
+   iovec parts[2] = {{buffer.get(), used}, {const_cast<char*>(extra.data()), extra.size()}};
+   iovec* current = parts;
+   int count = 2;
+   while (count) {
+      if (!current->iov_len) {
+         ++current;
+         --count;
+         continue;
+      }
+      ssize_t w = writev(fd, current, count);
+      if (w < 0) {
+         if (errno == EINTR) continue;
+         fail();
+      }
+      written += w;
+      totalWritten += w;
+      for (size_t done = w; done;) {
+         if (!current->iov_len) {
+            ++current;
+            --count;
+            continue;
+         }
+         size_t step = min(done, current->iov_len);
+         current->iov_base = static_cast<char*>(current->iov_base) + step;
+         current->iov_len -= step;
+         done -= step;
+      }
+   }
+   used = 0;
+}
+//---------------------------------------------------------------------------
+AsyncWriter::~AsyncWriter()
+// Destructor
+{
+   {
+      unique_lock guard(lock);
+      shutdown = true;
+   }
+   requestAvailable.notify_one();
+   writer.join();
+}
+//---------------------------------------------------------------------------
+void AsyncWriter::submit(Request request)
+// Queue a write
+{
+   {
+      unique_lock guard(lock);
+      slotAvailable.wait(guard, [&]() { return requests.size() < maxPending; });
+      requests.push_back(move(request));
+   }
+   requestAvailable.notify_one();
+}
+//---------------------------------------------------------------------------
+unique_ptr<char[]> AsyncWriter::getBuffer()
+// Get an empty buffer
+{
+   {
+      unique_lock guard(lock);
+      if (!freeBuffers.empty()) {
+         auto buffer = move(freeBuffers.back());
+         freeBuffers.pop_back();
+         return buffer;
+      }
+   }
+   return unique_ptr<char[]>(new char[bufferSize]);
+}
+//---------------------------------------------------------------------------
+void AsyncWriter::run()
+// Process the requests
+{
+   while (true) {
+      Request request;
+      {
+         unique_lock guard(lock);
+         requestAvailable.wait(guard, [&]() { return shutdown || (!requests.empty()); });
+         if (requests.empty())
+            return;
+         request = move(requests.front());
+         requests.pop_front();
+      }
+      slotAvailable.notify_one();
+
+      uint64_t begin = getMicroseconds();
+      for (size_t done = 0; done < request.size;) {
+         ssize_t w = write(request.fd, request.buffer.get() + done, request.size - done);
+         if (w < 0) {
+            if (errno == EINTR) continue;
+            cerr << "unable to write " << request.fileName << endl;
+            exit(1);
+         }
+         done += w;
+         OutputFile::totalWritten += w;
+      }
+      if (request.close && (::close(request.fd) != 0)) {
+         cerr << "unable to write " << request.fileName << endl;
+         exit(1);
+      }
+      totalWriteTime += getMicroseconds() - begin;
+
+      unique_lock guard(lock);
+      if (freeBuffers.size() < maxPending)
+         freeBuffers.push_back(move(request.buffer));
    }
-   return move(*res);
 }
 //---------------------------------------------------------------------------
-static void escapeHtml(ostream& out, string_view s)
+static void escapeHtml(OutputFile& out, string_view s)
 // Write a string, escaping HTML as needed
 {
    const char *current = s.data(), *end = s.data();
@@ -48,196 +384,381 @@ static void escapeHtml(ostream& out, string_view s)
    out << sv;
 }
 //---------------------------------------------------------------------------
-static void highlightFilename(ostream& out, string_view s) {
+static void highlightFilename(OutputFile& out, string_view s) {
    auto pos = s.find_last_of('/') + 1;
    out << s.substr(0, pos) << "<span class=\"filename\">" << s.substr(pos) << "</span>";
 }
 //---------------------------------------------------------------------------
+/// A set of line numbers, stored as runs of consecutive lines
+class LineSet {
+   private:
+   /// Runs of consecutive lines as first and last line
+   vector<pair<unsigned, unsigned>> runs;
+
+   public:
+   /// Add a line. Lines must be added in ascending order, duplicates are ignored
+   void add(unsigned line) {
+      if (runs.empty() || (line > runs.back().second + 1)) {
+         runs.emplace_back(line, line);
+      } else if (line > runs.back().second) {
+         runs.back().second = line;
+      }
+   }
+   /// Add a run of lines
+   void addRun(unsigned first, unsigned last) {
+      add(first);
+      if (last > runs.back().second) runs.back().second = last;
+   }
+   /// Is the set empty?
+   bool empty() const { return runs.empty(); }
+   /// The number of lines
+   unsigned size() const {
+      unsigned result = 0;
+      for (auto [first, last] : runs) result += last - first + 1;
+      return result;
+   }
+   /// The largest line, or 0 if empty
+   unsigned getMax() const { return runs.empty() ? 0 : runs.back().second; }
+   /// The runs
+   const vector<pair<unsigned, unsigned>>& getRuns() const { return runs; }
+   /// Call f for every line
+   template <class T>
+   void forEach(const T& f) const {
+      for (auto [first, last] : runs)
+         for (unsigned l = first;; ++l) {
+            f(l);
+            if (l == last) break;
+         }
+   }
+};
+//---------------------------------------------------------------------------
 struct HitList {
-   vector<unsigned> hits, misses;
+   LineSet hits, misses;
+   /// The number of lines of the source file
+   unsigned lineCount = 0;
 };
-using CoverageList = map<string, HitList>;
 //---------------------------------------------------------------------------
-class SourceWriter {
+/// The hit and missed lines of all files, indexed by the position of the file in the sorted list of source files
+class CoverageList {
    private:
-   ostream& out;
-   CoverageList& coverageList;
-   string fileName;
-   struct Part {
-      string str;
-      unsigned count;
-      bool hasCode;
-      bool regionEntry;
-   };
-   vector<Part> parts;
+   /// The source files, owned by the coverage mapping
+   vector<llvm::StringRef> files;
+   /// The lines
+   vector<HitList> lines;
 
    public:
-   /// Statistics
-   unsigned executableLines = 0, hitLines = 0;
-
    /// Constructor
-   SourceWriter(ostream& out, CoverageList& coverageList, string fileName) : out(out), coverageList(coverageList), fileName(fileName) {}
+   explicit CoverageList(vector<llvm::StringRef> files) : files(move(files)), lines(this->files.size()) {}
 
-   /// Add a fragment
-   void addData(string str, unsigned count, bool hasData, bool regionEntry);
-
-   /// Write the current line
-   void finishLine(unsigned lineNo);
+   /// The lines of a file
+   HitList& operator[](unsigned fileId) { return lines[fileId]; }
+   /// Find the lines of a file by name
+   const HitList* find(string_view file) const;
+   /// Write all hit or all missed lines
+   void write(OutputFile& out, LineSet HitList::* which) const;
+   /// Write the binary export
+   void writeBinary(OutputFile& out) const;
 };
 //---------------------------------------------------------------------------
-void SourceWriter::addData(string str, unsigned count, bool hasData, bool regionEntry) {
-   parts.push_back(Part{move(str), count, hasData, regionEntry});
+template <class T>
+static void writeRaw(OutputFile& out, const T* data, size_t count)
+// Write binary data
+{
+   out << string_view(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+//---------------------------------------------------------------------------
+static void writeLines(OutputFile& out, string_view file, const LineSet& lines)
+// Write lines in the hits/notreached format
+{
+   lines.forEach([&](unsigned l) { out << file << ':' << l << '\n'; });
+}
+//---------------------------------------------------------------------------
+const HitList* CoverageList::find(string_view file) const
+// Find the lines of a file by name
+{
+   auto iter = lower_bound(files.begin(), files.end(), llvm::StringRef(file.data(), file.size()));
+   if ((iter == files.end()) || (*iter != llvm::StringRef(file.data(), file.size())))
+      return nullptr;
+   return &lines[iter - files.begin()];
+}
+//---------------------------------------------------------------------------
+void CoverageList::write(OutputFile& out, LineSet HitList::* which) const
+// Write all hit or all missed lines
+{
+   for (unsigned index = 0, limit = files.size(); index < limit; ++index)
+      writeLines(out, {files[index].data(), files[index].size()}, lines[index].*which);
+}
+//---------------------------------------------------------------------------
+void CoverageList::writeBinary(OutputFile& out) const
+// Write the binary export
+{
+   namespace bc = binarycoverage;
+
+   // Compute the layout
+   vector<unsigned> exported;
+   for (unsigned index = 0, limit = files.size(); index < limit; ++index)
+      if ((!lines[index].hits.empty()) || (!lines[index].misses.empty()))
+         exported.push_back(index);
+   vector<bc::FileEntry> entries;
+   uint64_t offset = sizeof(bc::Header) + exported.size() * sizeof(bc::FileEntry);
+   uint32_t pathOffset = 0;
+   for (auto index : exported) {
+      auto& l = lines[index];
+      unsigned hitLines = l.hits.size(), lineLimit = max(l.hits.getMax(), l.misses.getMax()) + 1;
+      entries.push_back({offset, pathOffset, static_cast<uint32_t>(files[index].size()), lineLimit, hitLines, hitLines + l.misses.size(), l.lineCount});
+      offset += 2 * 8 * ((static_cast<uint64_t>(lineLimit) + 63) / 64);
+      pathOffset += files[index].size();
+   }
+   bc::Header header;
+   memcpy(header.magic, bc::magic, sizeof(bc::magic));
+   header.version = bc::version;
+   header.fileCount = exported.size();
+   header.fileTableOffset = sizeof(bc::Header);
+   header.pathsOffset = offset;
+   writeRaw(out, &header, 1);
+   writeRaw(out, entries.data(), entries.size());
+
+   // Write the bitmaps
+   vector<uint64_t> bitmap;
+   for (unsigned index = 0, limit = exported.size(); index < limit; ++index) {
+      auto& l = lines[exported[index]];
+      uint64_t words = (static_cast<uint64_t>(entries[index].lineLimit) + 63) / 64;
+      bitmap.assign(2 * words, 0);
+      l.hits.forEach([&](unsigned line) {
+         bitmap[line / 64] |= uint64_t(1) << (line % 64);
+         bitmap[words + line / 64] |= uint64_t(1) << (line % 64);
+      });
+      l.misses.forEach([&](unsigned line) { bitmap[line / 64] |= uint64_t(1) << (line % 64); });
+      writeRaw(out, bitmap.data(), bitmap.size());
+   }
+
+   // Write the paths
+   for (auto index : exported)
+      out << string_view(files[index].data(), files[index].size());
 }
 //---------------------------------------------------------------------------
-static bool isTrivialCode(const string& code)
+static bool isTrivialCode(string_view code)
 // Check for trivial code
 {
-   static const auto trivialRegex = [] {
-      return regex(
-         // Completely empty
-         R"(^\s*$)"
-         "|"
-         // Noop ;
-         R"(^;$)"
-         "|"
-         // Brackets
-         R"(^\s*[{}]*\s*$)"
-         "|"
-         // LLVM attributes C++11's "= default;" to the last t
-         R"(^t$)");
-   }();
-   return regex_match(code, trivialRegex);
-}
-//---------------------------------------------------------------------------
-void SourceWriter::finishLine(unsigned lineNo)
-// Write the current line
-{
-   unsigned maxCount = 0, candidates = 0, hitCandidates = 0, regionEntry = 0;
-   for (auto& p : parts) {
-      bool code = p.hasCode, hit = p.count;
-      if (isTrivialCode(p.str)) code = hit = false;
-      if (code) candidates++;
-      if (hit) hitCandidates++;
-      if (p.regionEntry && p.count) regionEntry++;
-      if (p.count > maxCount) maxCount = p.count;
-   }
-   if (candidates) {
-      executableLines++;
-      if (hitCandidates)
-         hitLines++;
-      auto& c = coverageList[fileName];
-      (hitCandidates ? c.hits : c.misses).push_back(lineNo);
-   }
-
-   // Write the line number
-   out << R"(<span class="lineNum">)";
-   out << std::format("{:>{}}", lineNo, 5);
-   out << "</span>";
-   // Write the line intro
-   if (!candidates) {
-      out << R"(            )";
-   } else if (candidates > hitCandidates) {
-      if (!regionEntry) {
-         out << R"(<span class="lineNoCov">)";
-      } else {
-         out << R"(<span class="linePartCov">)";
-      }
-      stringstream ss;
-      ss << hitCandidates << " / " << candidates << " ";
-      string s = ss.str();
-      for (unsigned index = s.length(); index < 12; ++index)
-         out << " ";
-      out << s << "</span>";
-   } else {
-      stringstream ss;
-      if (maxCount < 1000) {
-         ss << maxCount;
-      } else if (maxCount < 1000000) {
-         ss << (maxCount / 1000) << "K";
-      } else if (maxCount < 1000000000) {
-         ss << (maxCount / 1000000) << "M";
-      } else {
-         ss << (maxCount / 1000000000) << "G";
-      }
-      string s = ss.str();
-      for (unsigned index = s.length(); index < 12; ++index)
-         out << " ";
-      out << s << "</span>";
-   }
-
-   // Write the fragments
-   out << " : ";
-   unsigned mode = 0;
-   for (auto& p : parts) {
-      unsigned newMode;
-      if (p.hasCode && !isTrivialCode(p.str)) {
-         if (p.count) {
-            newMode = (candidates > hitCandidates) ? 2 : 3;
-         } else
-            newMode = 1;
-      } else {
-         newMode = 0;
+   // Noop ; and LLVM attributes C++11's "= default;" to the last t
+   if ((code == ";") || (code == "t"))
+      return true;
+
+   // Completely empty or a single run of brackets surrounded by whitespace
+   enum { Leading, Brackets, Trailing } state = Leading;
+   for (char c : code) {
+      switch (c) {
+         case ' ':
+         case '\t':
+         case '\n':
+         case '\v':
+         case '\f':
+         case '\r':
+            if (state == Brackets) state = Trailing;
+            break;
+         case '{':
+         case '}':
+            if (state == Trailing) return false;
+            state = Brackets;
+            break;
+         default: return false;
       }
-      if (mode != newMode) {
-         if (mode)
-            out << "</span>";
-         switch (newMode) {
-            case 0: break;
-            case 1: out << R"(<span class="lineNoCov">)"; break;
-            case 2: out << R"(<span class="linePartCov">)"; break;
-            case 3: out << R"(<span class="lineCov">)"; break;
+   }
+   return true;
+}
+//---------------------------------------------------------------------------
+class MappedFile {
+   private:
+   /// The mapping
+   const char* data = nullptr;
+   /// The size
+   size_t size = 0;
+   /// Could the file be opened?
+   bool valid = false;
+
+   public:
+   /// Constructor
+   explicit MappedFile(const string& file);
+   /// Destructor
+   ~MappedFile();
+   MappedFile(const MappedFile&) = delete;
+   MappedFile& operator=(const MappedFile&) = delete;
+
+   /// Could the file be opened?
+   bool isOpen() const { return valid; }
+   /// The file content
+   string_view content() const { return {data, size}; }
+};
+//---------------------------------------------------------------------------
+MappedFile::MappedFile(const string& file)
+// Map a file into memory
+{
+   int fd = open(file.c_str(), O_RDONLY);
+   if (fd < 0)
+      return;
+   struct stat s;
+   if ((fstat(fd, &s) == 0) && S_ISREG(s.st_mode)) {
+      if (!s.st_size) {
+         valid = true;
+      } else {
+         void* mapping = mmap(nullptr, s.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (mapping != MAP_FAILED) {
+            madvise(mapping, s.st_size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapping);
+            size = s.st_size;
+            valid = true;
          }
-         mode = newMode;
       }
-      escapeHtml(out, p.str);
    }
-   parts.clear();
-   if (mode)
-      out << "</span>";
-   out << endl;
+   close(fd);
 }
 //---------------------------------------------------------------------------
-class SourceReader {
+MappedFile::~MappedFile()
+// Destructor
+{
+   if (size)
+      munmap(const_cast<char*>(data), size);
+}
+//---------------------------------------------------------------------------
+/// Finds the exclusion markers and the --exclude-line patterns in a single pass over a source file. The patterns
+/// are compiled into an Aho-Corasick automaton once, scanning then costs one table lookup per byte
+class MarkerScanner {
+   public:
+   /// The kinds of markers, a line can contain several
+   enum Marker : uint8_t { ExclStop = 1, ExclStart = 2, ExclLine = 4, ExtraIgnore = 8 };
+
    private:
+   /// The class of every byte. Bytes that occur in no pattern share class 0
+   array<unsigned, 256> byteClass{};
+   /// The number of byte classes
+   unsigned classCount = 1;
+   /// The transitions, classCount entries per state
+   vector<unsigned> transitions;
+   /// The markers recognized when reaching a state
+   vector<uint8_t> markers;
+
+   public:
+   /// Constructor
+   explicit MarkerScanner(const vector<string>& extraIgnore);
+
+   /// Find the markers within the source. Returns the markers of every line
+   vector<uint8_t> scan(string_view source, size_t lineCount) const;
+};
+//---------------------------------------------------------------------------
+MarkerScanner::MarkerScanner(const vector<string>& extraIgnore)
+// Constructor
+{
+   // Patterns never match across lines, thus patterns containing a line break are ignored
+   vector<pair<string_view, Marker>> patterns = {{"LCOV_EXCL_STOP", ExclStop}, {"LCOV_EXCL_START", ExclStart}, {"LCOV_EXCL_LINE", ExclLine}};
+   for (auto& e : extraIgnore)
+      if ((!e.empty()) && (e.find('\n') == string::npos))
+         patterns.push_back({e, ExtraIgnore});
+   for (auto& p : patterns)
+      for (unsigned char c : p.first)
+         if (!byteClass[c]) byteClass[c] = classCount++;
+
+   // Build the trie
+   transitions.assign(classCount, 0);
+   markers.assign(1, 0);
+   for (auto& [pattern, marker] : patterns) {
+      unsigned state = 0;
+      for (unsigned char c : pattern) {
+         unsigned slot = state * classCount + byteClass[c];
+         if (!transitions[slot]) {
+            transitions[slot] = markers.size();
+            markers.push_back(0);
+            transitions.resize(transitions.size() + classCount, 0);
+         }
+         state = transitions[slot];
+      }
+      markers[state] |= marker;
+   }
+
+   // Resolve the failure links breadth-first, turning the trie into a complete automaton
+   vector<unsigned> fail(markers.size());
+   deque<unsigned> queue;
+   for (unsigned c = 0; c < classCount; ++c)
+      if (transitions[c]) queue.push_back(transitions[c]);
+   while (!queue.empty()) {
+      unsigned state = queue.front();
+      queue.pop_front();
+      markers[state] |= markers[fail[state]];
+      for (unsigned c = 0; c < classCount; ++c) {
+         unsigned& next = transitions[state * classCount + c];
+         unsigned fallback = transitions[fail[state] * classCount + c];
+         if (next) {
+            fail[next] = fallback;
+            queue.push_back(next);
+         } else {
+            next = fallback;
+         }
+      }
+   }
+}
+//---------------------------------------------------------------------------
+vector<uint8_t> MarkerScanner::scan(string_view source, size_t lineCount) const
+// Find the markers within the source
+{
+   // Line breaks occur in no pattern, they always return to the initial state
+   vector<uint8_t> result(lineCount);
+   unsigned state = 0;
+   size_t line = 0;
+   for (char c : source) {
+      state = transitions[state * classCount + byteClass[static_cast<unsigned char>(c)]];
+      if (c == '\n')
+         ++line;
+      else if (markers[state])
+         result[line] |= markers[state];
+   }
+   return result;
+}
+//---------------------------------------------------------------------------
+class SourceFile {
+   public:
    struct LineInfo {
-      string line;
+      unsigned begin, length;
       unsigned ignoreFrom, ignoreTo;
    };
 
-   SourceWriter& out;
+   /// The source code
+   string_view source;
+   /// The lines
    vector<LineInfo> lines;
-   unsigned lineNo, colPos;
 
-   public:
-   SourceReader(istream& in, SourceWriter& out, const vector<string>& extraIgnore);
+   /// Constructor. Splits the source into lines and computes the excluded ranges
+   SourceFile(string_view source, const MarkerScanner& markerScanner);
 
-   //// Skip to a position
-   void skipTo(unsigned line, unsigned col, unsigned count, bool hasCode, unsigned regionEntry);
-   /// Flush the rest
-   void flush();
+   /// The text of a line
+   string_view getLine(const LineInfo& i) const { return source.substr(i.begin, i.length); }
 };
 //---------------------------------------------------------------------------
-SourceReader::SourceReader(istream& in, SourceWriter& out, const vector<string>& extraIgnore)
-   : out(out), lineNo(0), colPos(0) {
+SourceFile::SourceFile(string_view source, const MarkerScanner& markerScanner)
+   : source(source) {
    // Collect all lines
-   string s;
+   size_t lineCount = count(source.begin(), source.end(), '\n') + 1;
+   lines.reserve(lineCount);
+   auto markers = markerScanner.scan(source, lineCount);
    bool ignoreBlock = false;
    vector<unsigned> ignoreLines;
-   while (getline(in, s)) {
+   for (size_t begin = 0, limit = source.length(); begin < limit;) {
+      size_t end = source.find('\n', begin);
+      if (end == string_view::npos) end = limit;
+      string_view s = source.substr(begin, end - begin);
+      uint8_t marker = markers[lines.size()];
       bool ignoreLine = false;
       if (ignoreBlock) {
          ignoreLine = true;
-         if (s.find("LCOV_EXCL_STOP") != string::npos)
+         if (marker & MarkerScanner::ExclStop)
             ignoreBlock = false;
       } else {
          ignoreLine = false;
-         if (s.find("LCOV_EXCL_START") != string::npos) {
+         if (marker & MarkerScanner::ExclStart) {
             ignoreLine = true;
             ignoreBlock = true;
-         } else if (s.find("LCOV_EXCL_LINE") != string::npos) {
+         } else if (marker & MarkerScanner::ExclLine) {
             ignoreLines.push_back(lines.size());
             ignoreLine = true;
-         } else if (any_of(extraIgnore.begin(), extraIgnore.end(), [&](const string& extraIgnore) { return (!extraIgnore.empty()) && (s.find(extraIgnore) != string::npos); })) {
+         } else if (marker & MarkerScanner::ExtraIgnore) {
             ignoreLines.push_back(lines.size());
             ignoreLine = true;
          }
@@ -246,14 +767,15 @@ SourceReader::SourceReader(istream& in, SourceWriter& out, const vector<string>&
       unsigned ignoreFrom = 0, ignoreTo = 0;
       if (ignoreLine)
          ignoreTo = s.length() + 1;
-      lines.push_back(LineInfo{move(s), ignoreFrom, ignoreTo});
+      lines.push_back(LineInfo{static_cast<unsigned>(begin), static_cast<unsigned>(s.length()), ignoreFrom, ignoreTo});
+      begin = end + 1;
    }
 
    // Single line comments cover the whole statement
    for (auto line : ignoreLines) {
       for (unsigned prev = line; prev > 0;) {
          auto& i = lines[--prev];
-         auto& l = i.line;
+         auto l = getLine(i);
          unsigned stop;
          for (stop = l.size(); stop; --stop) {
             char c = l[stop - 1];
@@ -275,7 +797,7 @@ SourceReader::SourceReader(istream& in, SourceWriter& out, const vector<string>&
       }
       for (unsigned next = line + 1, limit = lines.size(); next < limit; ++next) {
          auto& i = lines[next];
-         auto& l = i.line;
+         auto l = getLine(i);
          unsigned stop = 0;
          for (unsigned limit = l.size(); stop < limit; stop++) {
             char c = l[stop];
@@ -295,92 +817,799 @@ SourceReader::SourceReader(istream& in, SourceWriter& out, const vector<string>&
    }
 }
 //---------------------------------------------------------------------------
-static string getSubstr(const string& s, unsigned from, unsigned len)
+/// The coverage statistics of a file or of a whole report
+struct CoverageStats {
+   unsigned hitLines = 0, executableLines = 0;
+   unsigned hitBranches = 0, branches = 0;
+   unsigned coveredConditions = 0, conditions = 0;
+   /// The changes relative to a baseline profile
+   unsigned baselineHitLines = 0, baselineExecutableLines = 0;
+   unsigned newlyCovered = 0, newlyUncovered = 0, changedLines = 0;
+   /// The coverage of the lines changed by a patch
+   unsigned patchHitLines = 0, patchExecutableLines = 0;
+
+   /// Add the statistics of another file
+   CoverageStats& operator+=(const CoverageStats& other) {
+      hitLines += other.hitLines;
+      executableLines += other.executableLines;
+      hitBranches += other.hitBranches;
+      branches += other.branches;
+      coveredConditions += other.coveredConditions;
+      conditions += other.conditions;
+      baselineHitLines += other.baselineHitLines;
+      baselineExecutableLines += other.baselineExecutableLines;
+      newlyCovered += other.newlyCovered;
+      newlyUncovered += other.newlyUncovered;
+      changedLines += other.changedLines;
+      patchHitLines += other.patchHitLines;
+      patchExecutableLines += other.patchExecutableLines;
+      return *this;
+   }
+};
+//---------------------------------------------------------------------------
+static void countBranches(const llvm::coverage::CountedRegion& branch, unsigned& hit, unsigned& total)
+// Count the outcomes of a branch. Constant outcomes are not counted
+{
+   if (!branch.TrueFolded) {
+      ++total;
+      if (branch.ExecutionCount) ++hit;
+   }
+   if (!branch.FalseFolded) {
+      ++total;
+      if (branch.FalseExecutionCount) ++hit;
+   }
+}
+//---------------------------------------------------------------------------
+static void countConditions(const llvm::coverage::MCDCRecord& decision, unsigned& covered, unsigned& total)
+// Count the conditions of a decision that were shown to independently affect the outcome. Constant conditions are not counted
+{
+   for (unsigned condition = 0, limit = decision.getNumConditions(); condition < limit; ++condition) {
+      if (decision.isCondFolded(condition))
+         continue;
+      ++total;
+      if (decision.isConditionIndependencePairCovered(condition)) ++covered;
+   }
+}
+//---------------------------------------------------------------------------
+class LineCoverage {
+   public:
+   /// A fragment of a line with uniform coverage
+   struct Fragment {
+      unsigned begin, length;
+      uint64_t count;
+      bool hasCode;
+      bool regionEntry;
+      /// Does the fragment contain trivial code only?
+      bool trivial;
+   };
+   /// The summary of a line
+   struct Line {
+      unsigned lineNo;
+      unsigned fragmentsBegin, fragmentsEnd;
+      uint64_t maxCount;
+      unsigned candidates, hitCandidates, regionEntries;
+      unsigned branchesBegin, branchesEnd, decisionsBegin, decisionsEnd;
+   };
+
+   /// The source
+   const SourceFile& source;
+   /// All fragments
+   vector<Fragment> fragments;
+   /// All lines
+   vector<Line> lines;
+   /// All branches and MC/DC decisions that are not excluded, in line order
+   vector<const llvm::coverage::CountedRegion*> branches;
+   vector<const llvm::coverage::MCDCRecord*> decisions;
+   /// Statistics
+   CoverageStats stats;
+
+   private:
+   /// The current position
+   unsigned lineNo = 0, colPos = 0;
+   /// The branches and decisions sorted by position, and the first one that was not assigned to a line yet
+   vector<const llvm::coverage::CountedRegion*> pendingBranches;
+   vector<const llvm::coverage::MCDCRecord*> pendingDecisions;
+   unsigned nextBranch = 0, nextDecision = 0;
+
+   /// Is a position excluded from coverage?
+   bool isIgnored(unsigned line, unsigned col) const;
+
+   /// Add a fragment
+   void addData(string_view str, uint64_t count, bool hasCode, bool regionEntry);
+   /// Finish the current line
+   void finishLine(unsigned lineNo);
+   /// Skip to a position
+   void skipTo(unsigned line, unsigned col, uint64_t count, bool hasCode, unsigned regionEntry);
+   /// Flush the rest
+   void flush();
+
+   public:
+   /// Constructor. Breaks the coverage segments down into lines in a single pass, attaching branches and decisions on the way
+   LineCoverage(const SourceFile& source, const llvm::coverage::CoverageData& data);
+
+   /// The fragments of a line
+   span<const Fragment> getFragments(const Line& line) const { return span(fragments).subspan(line.fragmentsBegin, line.fragmentsEnd - line.fragmentsBegin); }
+   /// The branches of a line
+   span<const llvm::coverage::CountedRegion* const> getBranches(const Line& line) const { return span(branches).subspan(line.branchesBegin, line.branchesEnd - line.branchesBegin); }
+   /// The MC/DC decisions of a line
+   span<const llvm::coverage::MCDCRecord* const> getDecisions(const Line& line) const { return span(decisions).subspan(line.decisionsBegin, line.decisionsEnd - line.decisionsBegin); }
+   /// The text of a fragment
+   string_view getText(const Fragment& f) const { return source.source.substr(f.begin, f.length); }
+};
+//---------------------------------------------------------------------------
+LineCoverage::LineCoverage(const SourceFile& source, const llvm::coverage::CoverageData& data)
+   : source(source) {
+   lines.reserve(source.lines.size() + 1);
+   fragments.reserve(source.lines.size() + 2 * (data.end() - data.begin()));
+
+   // Branches and decisions are not ordered across functions, sort them so that they can be merged with the segments
+   for (auto& b : data.getBranches())
+      pendingBranches.push_back(&b);
+   stable_sort(pendingBranches.begin(), pendingBranches.end(), [](auto a, auto b) { return a->startLoc() < b->startLoc(); });
+   for (auto& d : data.getMCDCRecords())
+      pendingDecisions.push_back(&d);
+   stable_sort(pendingDecisions.begin(), pendingDecisions.end(), [](auto a, auto b) { return a->getDecisionRegion().startLoc() < b->getDecisionRegion().startLoc(); });
+
+   uint64_t currentCount = 0;
+   unsigned regionEntry = 0;
+   bool hasCode = false;
+   for (auto& i : data) {
+      skipTo(i.Line, i.Col, currentCount, hasCode, regionEntry);
+      currentCount = i.Count;
+      hasCode = i.HasCount && (!i.IsGapRegion);
+      regionEntry = i.IsRegionEntry ? i.Line : 0;
+   }
+   flush();
+}
+//---------------------------------------------------------------------------
+void LineCoverage::addData(string_view str, uint64_t count, bool hasCode, bool regionEntry)
+// Add a fragment
+{
+   unsigned begin = str.empty() ? 0 : (str.data() - source.source.data());
+   fragments.push_back(Fragment{begin, static_cast<unsigned>(str.length()), count, hasCode, regionEntry, isTrivialCode(str)});
+}
+//---------------------------------------------------------------------------
+void LineCoverage::finishLine(unsigned lineNo)
+// Finish the current line
+{
+   Line line{lineNo, lines.empty() ? 0 : lines.back().fragmentsEnd, static_cast<unsigned>(fragments.size()), 0, 0, 0, 0, 0, 0, 0, 0};
+   for (auto& p : getFragments(line)) {
+      bool code = p.hasCode, hit = p.count;
+      if (p.trivial) code = hit = false;
+      if (code) line.candidates++;
+      if (hit) line.hitCandidates++;
+      if (p.regionEntry && p.count) line.regionEntries++;
+      if (p.count > line.maxCount) line.maxCount = p.count;
+   }
+   if (line.candidates) {
+      stats.executableLines++;
+      if (line.hitCandidates)
+         stats.hitLines++;
+   }
+
+   // Attach the branches and decisions that start within the line
+   line.branchesBegin = branches.size();
+   for (; (nextBranch < pendingBranches.size()) && (pendingBranches[nextBranch]->LineStart <= lineNo); ++nextBranch) {
+      auto b = pendingBranches[nextBranch];
+      if ((b->LineStart == lineNo) && (!isIgnored(lineNo, b->ColumnStart))) {
+         branches.push_back(b);
+         countBranches(*b, stats.hitBranches, stats.branches);
+      }
+   }
+   line.branchesEnd = branches.size();
+   line.decisionsBegin = decisions.size();
+   for (; (nextDecision < pendingDecisions.size()) && (pendingDecisions[nextDecision]->getDecisionRegion().LineStart <= lineNo); ++nextDecision) {
+      auto d = pendingDecisions[nextDecision];
+      if ((d->getDecisionRegion().LineStart == lineNo) && (!isIgnored(lineNo, d->getDecisionRegion().ColumnStart))) {
+         decisions.push_back(d);
+         countConditions(*d, stats.coveredConditions, stats.conditions);
+      }
+   }
+   line.decisionsEnd = decisions.size();
+
+   lines.push_back(line);
+}
+//---------------------------------------------------------------------------
+bool LineCoverage::isIgnored(unsigned line, unsigned col) const
+// Is a position excluded from coverage?
+{
+   if ((!line) || (line > source.lines.size()))
+      return false;
+   auto& i = source.lines[line - 1];
+   return (i.ignoreFrom < col) && (col <= i.ignoreTo);
+}
+//---------------------------------------------------------------------------
+static string_view getSubstr(string_view s, unsigned from, unsigned len)
 // A substring that handles out-of-bounds more gracefully. Needed if the source code gets out of sync
 {
    if (from >= s.length()) return {};
-   if (s.length() - from <= len) return s.substr(from);
    return s.substr(from, len);
 }
 //---------------------------------------------------------------------------
-void SourceReader::skipTo(unsigned targetLine, unsigned col, unsigned count, bool hasCode, unsigned regionEntry) {
+void LineCoverage::skipTo(unsigned targetLine, unsigned col, uint64_t count, bool hasCode, unsigned regionEntry)
+// Skip to a position
+{
    if (targetLine > lineNo) {
       if (lineNo) {
-         if (colPos < lines[lineNo - 1].line.length()) {
-            bool ignore = (lines[lineNo - 1].ignoreFrom <= colPos) && (colPos < lines[lineNo - 1].ignoreTo);
-            out.addData(getSubstr(lines[lineNo - 1].line, colPos, ~0u), count, hasCode && (count || !ignore), lineNo == regionEntry);
+         if (colPos < source.lines[lineNo - 1].length) {
+            bool ignore = (source.lines[lineNo - 1].ignoreFrom <= colPos) && (colPos < source.lines[lineNo - 1].ignoreTo);
+            addData(getSubstr(source.getLine(source.lines[lineNo - 1]), colPos, ~0u), count, hasCode && (count || !ignore), lineNo == regionEntry);
          }
-         out.finishLine(lineNo);
+         finishLine(lineNo);
       }
       while (lineNo < targetLine) {
-         if (lineNo >= lines.size())
+         if (lineNo >= source.lines.size())
             break;
 
          // Handle ignore settings
-         auto& i = lines[lineNo];
+         auto& i = source.lines[lineNo];
          ++lineNo;
          colPos = 0;
          if (lineNo < targetLine) {
-            if ((i.ignoreFrom != i.ignoreTo) && ((i.ignoreFrom != 0) || (i.ignoreTo != i.line.size()))) {
+            if ((i.ignoreFrom != i.ignoreTo) && ((i.ignoreFrom != 0) || (i.ignoreTo != i.length))) {
                if (i.ignoreFrom)
-                  out.addData(getSubstr(i.line, 0, i.ignoreFrom), count, hasCode, lineNo == regionEntry);
-               out.addData(getSubstr(i.line, i.ignoreFrom, i.ignoreTo - i.ignoreFrom), count, hasCode && count, lineNo == regionEntry);
-               if (i.ignoreTo < i.line.length())
-                  out.addData(getSubstr(i.line, i.ignoreTo, i.line.length()), count, hasCode, lineNo == regionEntry);
+                  addData(getSubstr(source.getLine(i), 0, i.ignoreFrom), count, hasCode, lineNo == regionEntry);
+               addData(getSubstr(source.getLine(i), i.ignoreFrom, i.ignoreTo - i.ignoreFrom), count, hasCode && count, lineNo == regionEntry);
+               if (i.ignoreTo < i.length)
+                  addData(getSubstr(source.getLine(i), i.ignoreTo, i.length), count, hasCode, lineNo == regionEntry);
             } else {
                bool ignore = (i.ignoreFrom != i.ignoreTo);
-               out.addData(i.line, count, hasCode && (count || !ignore), lineNo == regionEntry);
+               addData(source.getLine(i), count, hasCode && (count || !ignore), lineNo == regionEntry);
             }
-            out.finishLine(lineNo);
+            finishLine(lineNo);
          }
       }
    }
    if (col > colPos + 1) {
-      bool ignore = (lines[lineNo - 1].ignoreFrom <= colPos) && (colPos < lines[lineNo - 1].ignoreTo);
-      out.addData(getSubstr(lines[lineNo - 1].line, colPos, (col - 1) - colPos), count, hasCode && (count || !ignore), lineNo == regionEntry);
+      bool ignore = (source.lines[lineNo - 1].ignoreFrom <= colPos) && (colPos < source.lines[lineNo - 1].ignoreTo);
+      addData(getSubstr(source.getLine(source.lines[lineNo - 1]), colPos, (col - 1) - colPos), count, hasCode && (count || !ignore), lineNo == regionEntry);
       colPos = col - 1;
    }
 }
 //---------------------------------------------------------------------------
-void SourceReader::flush()
+void LineCoverage::flush()
 // Flush the rest
 {
    if (lineNo) {
-      out.addData(lines[lineNo - 1].line.substr(colPos), 0, false, 0);
-      out.finishLine(lineNo);
+      addData(getSubstr(source.getLine(source.lines[lineNo - 1]), colPos, ~0u), 0, false, 0);
+      finishLine(lineNo);
       ++lineNo;
+   } else {
+      lineNo = 1;
    }
-   for (unsigned limit = lines.size(); lineNo <= limit; ++lineNo) {
-      out.addData(lines[lineNo - 1].line, 0, false, 0);
-      out.finishLine(lineNo);
+   for (unsigned limit = source.lines.size(); lineNo <= limit; ++lineNo) {
+      addData(source.getLine(source.lines[lineNo - 1]), 0, false, 0);
+      finishLine(lineNo);
    }
 }
 //---------------------------------------------------------------------------
-static void processCode(ostream& out, CoverageList& coverageList, llvm::coverage::CoverageMapping& coverage, llvm::StringRef file, const vector<string>& extraIgnore, unsigned& hitLines, unsigned& executableLines)
-// Process a file
+/// The coverage of a function
+struct FunctionInfo {
+   /// The demangled name
+   string name;
+   /// The first line
+   unsigned line;
+   /// The number of calls
+   uint64_t executionCount;
+   /// The code regions
+   unsigned coveredRegions, regions;
+};
+//---------------------------------------------------------------------------
+static vector<vector<const llvm::coverage::FunctionRecord*>> bucketFunctions(const llvm::coverage::CoverageMapping& coverage, const vector<llvm::StringRef>& files)
+// Bucket the function records by file in a single pass. The files must be sorted
 {
-   hitLines = executableLines = 0;
-   ifstream in(file.str());
-   if (!in.is_open()) {
-      out << "<br/><h4>No source code found!</h4><br/>" << endl;
-      return;
+   vector<vector<const llvm::coverage::FunctionRecord*>> functions(files.size());
+   for (auto& f : coverage.getCoveredFunctions()) {
+      if (f.Filenames.empty() || f.CountedRegions.empty())
+         continue;
+      auto iter = lower_bound(files.begin(), files.end(), llvm::StringRef(f.Filenames.front()));
+      if ((iter != files.end()) && (*iter == f.Filenames.front()))
+         functions[iter - files.begin()].push_back(&f);
    }
+   return functions;
+}
+//---------------------------------------------------------------------------
+static vector<FunctionInfo> collectFunctions(span<const llvm::coverage::FunctionRecord* const> records)
+// Collect the coverage of the functions of a file, sorted by line
+{
+   vector<FunctionInfo> functions;
+   functions.reserve(records.size());
+   for (auto f : records) {
+      // Strip the file prefix of local functions before demangling
+      string name = f->Name;
+      auto mangled = name.find("_Z");
+      if ((mangled != string::npos) && (mangled > 0) && ((name[mangled - 1] == ':') || (name[mangled - 1] == ';')))
+         name = name.substr(mangled);
 
-   SourceWriter writer(out, coverageList, file.str());
-   SourceReader reader(in, writer, extraIgnore);
-   auto data = coverage.getCoverageForFile(file);
-   unsigned currentCount = 0, regionEntry = 0;
-   bool hasCode = false;
-   for (auto& i : data) {
-      reader.skipTo(i.Line, i.Col, currentCount, hasCode, regionEntry);
-      currentCount = i.Count;
-      hasCode = i.HasCount && (!i.IsGapRegion);
-      regionEntry = i.IsRegionEntry ? i.Line : 0;
+      FunctionInfo info{llvm::demangle(name), 0, f->ExecutionCount, 0, 0};
+      for (auto& r : f->CountedRegions) {
+         if (r.Kind != llvm::coverage::CounterMappingRegion::CodeRegion)
+            continue;
+         if ((!info.line) && (!r.FileID))
+            info.line = r.LineStart;
+         ++info.regions;
+         if (r.ExecutionCount) ++info.coveredRegions;
+      }
+      functions.push_back(move(info));
    }
-   reader.flush();
+   stable_sort(functions.begin(), functions.end(), [](const FunctionInfo& a, const FunctionInfo& b) { return a.line < b.line; });
+   return functions;
+}
+//---------------------------------------------------------------------------
+static const char* getBranchClass(unsigned hit, unsigned total)
+// The style of a branch or decision summary
+{
+   if (hit == total)
+      return "branchCov";
+   return hit ? "branchPartCov" : "branchNoCov";
+}
+//---------------------------------------------------------------------------
+/// The change of a line relative to a baseline profile
+enum class LineDelta : uint8_t { None, NewlyCovered, NewlyUncovered, CountChanged };
+//---------------------------------------------------------------------------
+static vector<LineDelta> computeDeltas(const LineCoverage& coverage, const LineCoverage& baseline, unsigned threshold, CoverageStats& stats)
+// Compare the lines with the baseline, both were computed from the same source. Counts are considered changed if they differ by more than threshold percent
+{
+   vector<LineDelta> deltas(coverage.lines.size(), LineDelta::None);
+   stats.baselineHitLines = baseline.stats.hitLines;
+   stats.baselineExecutableLines = baseline.stats.executableLines;
+   for (size_t index = 0, limit = min(coverage.lines.size(), baseline.lines.size()); index < limit; ++index) {
+      auto& c = coverage.lines[index];
+      auto& b = baseline.lines[index];
+      bool hit = c.candidates && c.hitCandidates, baselineHit = b.candidates && b.hitCandidates;
+      if (hit && !baselineHit) {
+         deltas[index] = LineDelta::NewlyCovered;
+         ++stats.newlyCovered;
+      } else if (c.candidates && !hit && baselineHit) {
+         deltas[index] = LineDelta::NewlyUncovered;
+         ++stats.newlyUncovered;
+      } else if (hit && baselineHit) {
+         uint64_t diff = (c.maxCount > b.maxCount) ? (c.maxCount - b.maxCount) : (b.maxCount - c.maxCount);
+         if (diff * 100 > static_cast<uint64_t>(threshold) * b.maxCount) {
+            deltas[index] = LineDelta::CountChanged;
+            ++stats.changedLines;
+         }
+      }
+   }
+   return deltas;
+}
+//---------------------------------------------------------------------------
+static unsigned getHeatLevel(uint64_t count)
+// The heat of an execution count on a logarithmic scale from 0 to 9
+{
+   unsigned level = 0;
+   for (; (count >= 10) && (level < 9); count /= 10)
+      ++level;
+   return level;
+}
+//---------------------------------------------------------------------------
+static void writeSource(OutputFile& out, const LineCoverage& coverage, span<const unsigned> anchors, bool heatmap, const LineCoverage* baseline, span<const LineDelta> deltas, const LineSet* patchLines)
+// Write the source code. The given lines (sorted) receive anchors. In heatmap mode executed lines are colored by their execution count. With a baseline every line is marked with its change, with a patch the changed lines are highlighted
+{
+   auto nextAnchor = anchors.begin();
+   span<const pair<unsigned, unsigned>> patchRuns;
+   if (patchLines)
+      patchRuns = patchLines->getRuns();
+   for (auto& line : coverage.lines) {
+      // Write the line number
+      while ((nextAnchor != anchors.end()) && (*nextAnchor < line.lineNo))
+         ++nextAnchor;
+      while ((!patchRuns.empty()) && (patchRuns.front().second < line.lineNo))
+         patchRuns = patchRuns.subspan(1);
+      const char* lineNumClass = ((!patchRuns.empty()) && (patchRuns.front().first <= line.lineNo)) ? "lineNumChanged" : "lineNum";
+      if ((nextAnchor != anchors.end()) && (*nextAnchor == line.lineNo))
+         out << R"(<span class=")" << lineNumClass << R"(" id="L)" << line.lineNo << R"(">)";
+      else
+         out << R"(<span class=")" << lineNumClass << R"(">)";
+      out.writeRightAligned(ShortString() << line.lineNo, 5);
+      out << "</span>";
 
-   hitLines = writer.hitLines;
-   executableLines = writer.executableLines;
+      // Write the change relative to the baseline
+      if (baseline) {
+         unsigned index = &line - coverage.lines.data();
+         auto delta = (index < deltas.size()) ? deltas[index] : LineDelta::None;
+         switch (delta) {
+            case LineDelta::None: out << "  "; break;
+            case LineDelta::NewlyCovered: out << R"(<span class="deltaNew" title="newly covered">+ </span>)"; break;
+            case LineDelta::NewlyUncovered: out << R"(<span class="deltaLost" title="no longer covered">- </span>)"; break;
+            case LineDelta::CountChanged: out << R"(<span class="deltaChanged" title="baseline: )" << baseline->lines[index].maxCount << R"(">~ </span>)"; break;
+         }
+      }
+      // Write the line intro
+      unsigned candidates = line.candidates, hitCandidates = line.hitCandidates;
+      if (!candidates) {
+         out << R"(            )";
+      } else if (candidates > hitCandidates) {
+         if (!line.regionEntries) {
+            out << R"(<span class="lineNoCov">)";
+         } else {
+            out << R"(<span class="linePartCov">)";
+         }
+         out.writeRightAligned(ShortString() << hitCandidates << " / " << candidates << ' ', 12);
+         out << "</span>";
+      } else {
+         ShortString s;
+         uint64_t maxCount = line.maxCount;
+         if (maxCount < 1000) {
+            s << maxCount;
+         } else if (maxCount < 1000000) {
+            s << (maxCount / 1000) << 'K';
+         } else if (maxCount < 1000000000) {
+            s << (maxCount / 1000000) << 'M';
+         } else {
+            s << (maxCount / 1000000000) << 'G';
+         }
+         out.writeRightAligned(s, 12);
+         out << "</span>";
+      }
+
+      // Write the fragments
+      out << " : ";
+      bool hot = heatmap && candidates && line.maxCount;
+      if (hot)
+         out << R"(<span class="heat)" << getHeatLevel(line.maxCount) << R"(">)";
+      unsigned mode = 0;
+      for (auto& p : coverage.getFragments(line)) {
+         unsigned newMode;
+         if (hot) {
+            newMode = 0;
+         } else if (p.hasCode && !p.trivial) {
+            if (p.count) {
+               newMode = (candidates > hitCandidates) ? 2 : 3;
+            } else
+               newMode = 1;
+         } else {
+            newMode = 0;
+         }
+         if (mode != newMode) {
+            if (mode)
+               out << "</span>";
+            switch (newMode) {
+               case 0: break;
+               case 1: out << R"(<span class="lineNoCov">)"; break;
+               case 2: out << R"(<span class="linePartCov">)"; break;
+               case 3: out << R"(<span class="lineCov">)"; break;
+            }
+            mode = newMode;
+         }
+         escapeHtml(out, coverage.getText(p));
+      }
+      if (mode)
+         out << "</span>";
+      if (hot)
+         out << "</span>";
+
+      // Write the branches and decisions, with the details as tooltip
+      if (line.branchesBegin != line.branchesEnd) {
+         unsigned hit = 0, total = 0;
+         for (auto b : coverage.getBranches(line))
+            countBranches(*b, hit, total);
+         out << R"(  <span class=")" << getBranchClass(hit, total) << R"(" title=")";
+         bool first = true;
+         for (auto b : coverage.getBranches(line)) {
+            if (!first) out << "&#10;";
+            out << "Branch (" << b->LineStart << ':' << b->ColumnStart << "): True: ";
+            if (b->TrueFolded)
+               out << "folded";
+            else
+               out << b->ExecutionCount;
+            out << ", False: ";
+            if (b->FalseFolded)
+               out << "folded";
+            else
+               out << b->FalseExecutionCount;
+            first = false;
+         }
+         out << "\">[" << hit << '/' << total << " branches]</span>";
+      }
+      if (line.decisionsBegin != line.decisionsEnd) {
+         unsigned covered = 0, total = 0;
+         for (auto d : coverage.getDecisions(line))
+            countConditions(*d, covered, total);
+         out << R"(  <span class=")" << getBranchClass(covered, total) << R"(" title=")";
+         bool first = true;
+         for (auto d : coverage.getDecisions(line)) {
+            if (!first) out << "&#10;";
+            out << "Decision (" << d->getDecisionRegion().LineStart << ':' << d->getDecisionRegion().ColumnStart << "):";
+            for (unsigned condition = 0, limit = d->getNumConditions(); condition < limit; ++condition) {
+               out << " C" << (condition + 1) << ' ';
+               if (d->isCondFolded(condition))
+                  out << "folded";
+               else if (d->isConditionIndependencePairCovered(condition))
+                  out << "covered";
+               else
+                  out << "not covered";
+            }
+            first = false;
+         }
+         out << "\">[" << covered << '/' << total << " MC/DC conditions]</span>";
+      }
+      out << '\n';
+   }
+}
+//---------------------------------------------------------------------------
+/// A frequently executed line
+struct HotLine {
+   unsigned line;
+   uint64_t count;
+};
+//---------------------------------------------------------------------------
+static bool isHotter(const HotLine& a, const HotLine& b)
+// Order lines by decreasing execution count
+{
+   if (a.count != b.count)
+      return a.count > b.count;
+   return a.line < b.line;
+}
+//---------------------------------------------------------------------------
+static vector<HotLine> collectHotLines(const LineCoverage& coverage, unsigned limit)
+// Collect the most frequently executed lines
+{
+   vector<HotLine> hotLines;
+   for (auto& line : coverage.lines)
+      if (line.candidates && line.maxCount)
+         hotLines.push_back({line.lineNo, line.maxCount});
+   if (hotLines.size() > limit) {
+      partial_sort(hotLines.begin(), hotLines.begin() + limit, hotLines.end(), isHotter);
+      hotLines.resize(limit);
+   } else {
+      sort(hotLines.begin(), hotLines.end(), isHotter);
+   }
+   return hotLines;
+}
+//---------------------------------------------------------------------------
+static void collectLines(HitList& hitList, const LineCoverage& coverage)
+// Collect the hit and missed lines
+{
+   for (auto& line : coverage.lines)
+      if (line.candidates)
+         (line.hitCandidates ? hitList.hits : hitList.misses).add(line.lineNo);
+   hitList.lineCount = coverage.lines.size();
+}
+//---------------------------------------------------------------------------
+/// The version of the generated pages. Must be increased whenever the output changes, as it invalidates incremental reports
+static constexpr unsigned reportVersion = 3;
+//---------------------------------------------------------------------------
+class Manifest {
+   public:
+   /// The state of a source file in a report
+   struct Entry {
+      uint64_t sourceHash = 0, coverageHash = 0;
+      CoverageStats stats;
+      string htmlFile, prettyName;
+      /// The hit and missed lines. Only filled for loaded manifests
+      HitList lines;
+      /// The most frequently executed lines in heatmap mode
+      vector<HotLine> hotLines;
+   };
+   /// The entries, by source file
+   map<string, Entry> entries;
+   /// The hash of the settings the report was rendered with. Entries written with different settings must not be reused
+   uint64_t settingsHash = 0;
+
+   /// Load a manifest. Fails if the manifest is missing or malformed
+   bool load(const string& fileName);
+   /// Write the manifest
+   void write(const string& fileName, const CoverageList& coverageList) const;
+};
+//---------------------------------------------------------------------------
+/// The first word of a manifest
+static constexpr string_view manifestMagic = "llvmcov2html-manifest";
+//---------------------------------------------------------------------------
+template <class T>
+static bool parseNumber(string_view s, T& value)
+// Parse a decimal number
+{
+   auto res = from_chars(s.data(), s.data() + s.size(), value);
+   return (res.ec == errc()) && (res.ptr == s.data() + s.size());
+}
+//---------------------------------------------------------------------------
+static string_view nextToken(string_view& s, char separator)
+// Split off the text up to the next separator
+{
+   auto pos = s.find(separator);
+   auto token = s.substr(0, pos);
+   s = (pos == string_view::npos) ? string_view() : s.substr(pos + 1);
+   return token;
+}
+//---------------------------------------------------------------------------
+bool Manifest::load(const string& fileName)
+// Load a manifest
+{
+   MappedFile file(fileName);
+   if (!file.isOpen())
+      return false;
+   string_view content = file.content();
+
+   // Read the settings
+   string_view header = nextToken(content, '\n');
+   if ((nextToken(header, ' ') != manifestMagic) || (!parseNumber(header, settingsHash)))
+      return false;
+
+   // Read the entries, each one consists of a description line, the hit and missed lines, and the hot lines
+   auto parseLines = [](string_view s, LineSet& lines) {
+      while (!s.empty()) {
+         string_view run = nextToken(s, ',');
+         unsigned first, last;
+         if (!parseNumber(nextToken(run, '-'), first))
+            return false;
+         last = first;
+         if ((!run.empty()) && (!parseNumber(run, last)))
+            return false;
+         lines.addRun(first, last);
+      }
+      return true;
+   };
+   while (!content.empty()) {
+      string_view description = nextToken(content, '\n');
+      string file(nextToken(description, '\t'));
+      Entry e;
+      auto& st = e.stats;
+      if ((!parseNumber(nextToken(description, '\t'), e.sourceHash)) || (!parseNumber(nextToken(description, '\t'), e.coverageHash)) || (!parseNumber(nextToken(description, '\t'), st.hitLines)) || (!parseNumber(nextToken(description, '\t'), st.executableLines)) ||
+          (!parseNumber(nextToken(description, '\t'), st.hitBranches)) || (!parseNumber(nextToken(description, '\t'), st.branches)) || (!parseNumber(nextToken(description, '\t'), st.coveredConditions)) || (!parseNumber(nextToken(description, '\t'), st.conditions)) ||
+          (!parseNumber(nextToken(description, '\t'), st.baselineHitLines)) || (!parseNumber(nextToken(description, '\t'), st.baselineExecutableLines)) || (!parseNumber(nextToken(description, '\t'), st.newlyCovered)) || (!parseNumber(nextToken(description, '\t'), st.newlyUncovered)) || (!parseNumber(nextToken(description, '\t'), st.changedLines)) ||
+          (!parseNumber(nextToken(description, '\t'), st.patchHitLines)) || (!parseNumber(nextToken(description, '\t'), st.patchExecutableLines)) || (!parseNumber(nextToken(description, '\t'), e.lines.lineCount)))
+         return false;
+      e.htmlFile = nextToken(description, '\t');
+      e.prettyName = description;
+      if ((!parseLines(nextToken(content, '\n'), e.lines.hits)) || (!parseLines(nextToken(content, '\n'), e.lines.misses)))
+         return false;
+      for (string_view hotLines = nextToken(content, '\n'); !hotLines.empty();) {
+         string_view hotLine = nextToken(hotLines, ',');
+         HotLine h;
+         if ((!parseNumber(nextToken(hotLine, ':'), h.line)) || (!parseNumber(hotLine, h.count)))
+            return false;
+         e.hotLines.push_back(h);
+      }
+      entries[move(file)] = move(e);
+   }
+   return true;
+}
+//---------------------------------------------------------------------------
+void Manifest::write(const string& fileName, const CoverageList& coverageList) const
+// Write the manifest
+{
+   auto writeRuns = [](OutputFile& out, const LineSet& lines) {
+      bool firstRun = true;
+      for (auto [first, last] : lines.getRuns()) {
+         if (!firstRun) out << ',';
+         out << first;
+         if (last != first) out << '-' << last;
+         firstRun = false;
+      }
+      out << '\n';
+   };
+
+   OutputFile out(fileName);
+   out << manifestMagic << ' ' << settingsHash << '\n';
+   static const HitList noLines;
+   for (auto& [file, e] : entries) {
+      auto& st = e.stats;
+      auto lines = coverageList.find(file);
+      if (!lines) lines = &noLines;
+      out << file << '\t' << e.sourceHash << '\t' << e.coverageHash << '\t' << st.hitLines << '\t' << st.executableLines << '\t' << st.hitBranches << '\t' << st.branches << '\t' << st.coveredConditions << '\t' << st.conditions << '\t' << st.baselineHitLines << '\t' << st.baselineExecutableLines << '\t' << st.newlyCovered << '\t' << st.newlyUncovered << '\t' << st.changedLines << '\t' << st.patchHitLines << '\t' << st.patchExecutableLines << '\t' << lines->lineCount << '\t' << e.htmlFile << '\t' << e.prettyName << '\n';
+      writeRuns(out, lines->hits);
+      writeRuns(out, lines->misses);
+      bool firstHotLine = true;
+      for (auto& h : e.hotLines) {
+         if (!firstHotLine) out << ',';
+         out << h.line << ':' << h.count;
+         firstHotLine = false;
+      }
+      out << '\n';
+   }
+   out.close();
+}
+//---------------------------------------------------------------------------
+static uint64_t hashCoverage(const llvm::coverage::CoverageData& data)
+// Compute a digest of the coverage of a file
+{
+   vector<uint64_t> values;
+   values.reserve(3 * (data.end() - data.begin()));
+   for (auto& s : data) {
+      values.push_back((static_cast<uint64_t>(s.Line) << 32) | s.Col);
+      values.push_back(s.Count);
+      values.push_back(s.HasCount | (s.IsRegionEntry << 1) | (s.IsGapRegion << 2));
+   }
+   for (auto& b : data.getBranches()) {
+      values.push_back((static_cast<uint64_t>(b.LineStart) << 32) | b.ColumnStart);
+      values.push_back(b.TrueFolded ? ~0ull : b.ExecutionCount);
+      values.push_back(b.FalseFolded ? ~0ull : b.FalseExecutionCount);
+   }
+   for (auto& d : data.getMCDCRecords()) {
+      values.push_back((static_cast<uint64_t>(d.getDecisionRegion().LineStart) << 32) | d.getDecisionRegion().ColumnStart);
+      for (unsigned condition = 0, limit = d.getNumConditions(); condition < limit; ++condition)
+         values.push_back(d.isCondFolded(condition) | (d.isConditionIndependencePairCovered(condition) << 1));
+   }
+   return llvm::xxh3_64bits(llvm::ArrayRef(reinterpret_cast<const uint8_t*>(values.data()), values.size() * sizeof(uint64_t)));
+}
+//---------------------------------------------------------------------------
+/// The lines added or changed by a unified diff
+class Patch {
+   public:
+   /// The changed lines, by path as given in the diff
+   map<string, LineSet, less<>> files;
+
+   /// Parse a unified diff
+   bool load(const string& fileName);
+   /// Find the changed lines of a source file. Paths in the diff are usually relative, the longest matching suffix is used
+   const LineSet* find(string_view file) const;
+};
+//---------------------------------------------------------------------------
+bool Patch::load(const string& fileName)
+// Parse a unified diff
+{
+   MappedFile file(fileName);
+   if (!file.isOpen())
+      return false;
+
+   LineSet* current = nullptr;
+   unsigned line = 0, oldRemaining = 0, newRemaining = 0;
+   for (string_view content = file.content(); !content.empty();) {
+      string_view l = nextToken(content, '\n');
+      if ((!l.empty()) && (l.back() == '\r')) l.remove_suffix(1);
+
+      // Lines within a hunk, which must not exceed the line counts of its header
+      if (oldRemaining || newRemaining) {
+         if (l.starts_with('+')) {
+            if (!newRemaining)
+               return false;
+            if (current) current->add(line);
+            ++line;
+            --newRemaining;
+         } else if (l.starts_with('-')) {
+            if (!oldRemaining)
+               return false;
+            --oldRemaining;
+         } else if (!l.starts_with('\\')) {
+            if ((!oldRemaining) || (!newRemaining))
+               return false;
+            ++line;
+            --oldRemaining;
+            --newRemaining;
+         }
+         continue;
+      }
+
+      if (l.starts_with("+++ ")) {
+         // The new name of a file, without timestamp and git prefix
+         l = l.substr(4);
+         string_view name = nextToken(l, '\t');
+         if (name.starts_with("b/")) name = name.substr(2);
+         current = (name == "/dev/null") ? nullptr : &files[string(name)];
+      } else if (l.starts_with("@@ -")) {
+         // A hunk header, @@ -from[,count] +from[,count] @@
+         l = l.substr(4);
+         string_view oldRange = nextToken(l, ' ');
+         if (!l.starts_with('+'))
+            return false;
+         l = l.substr(1);
+         string_view newRange = nextToken(l, ' ');
+         oldRemaining = newRemaining = 1;
+         nextToken(oldRange, ',');
+         if ((!oldRange.empty()) && (!parseNumber(oldRange, oldRemaining)))
+            return false;
+         if (!parseNumber(nextToken(newRange, ','), line))
+            return false;
+         if ((!newRange.empty()) && (!parseNumber(newRange, newRemaining)))
+            return false;
+      }
+   }
+   return true;
+}
+//---------------------------------------------------------------------------
+const LineSet* Patch::find(string_view file) const
+// Find the changed lines of a source file
+{
+   for (string_view suffix = file;;) {
+      auto iter = files.find(suffix);
+      if (iter != files.end())
+         return &iter->second;
+      auto split = suffix.find('/');
+      if (split == string_view::npos)
+         return nullptr;
+      suffix = suffix.substr(split + 1);
+   }
 }
 //---------------------------------------------------------------------------
 static inline unsigned computePerc(unsigned hitLines, unsigned executableLines)
@@ -396,7 +1625,131 @@ static inline unsigned computePerc(unsigned hitLines, unsigned executableLines)
    return perc;
 }
 //---------------------------------------------------------------------------
-static void writeHeader(ostream& out, const string& binaryName, const string& timestamp, const string& prettyFile, unsigned hitLines, unsigned executableLines, bool hasSearch)
+static ShortString formatPerc(unsigned perc)
+// Format a percentage (x10)
+{
+   return ShortString() << (perc / 10) << '.' << (perc % 10);
+}
+//---------------------------------------------------------------------------
+/// A row of a function table
+struct FunctionRow {
+   const FunctionInfo* function;
+   /// The page, the name and the path of the file, if the table spans several files
+   string_view htmlFile, prettyName, path;
+};
+//---------------------------------------------------------------------------
+static void writeTableTitle(OutputFile& out, string_view title)
+// Write the title of a table
+{
+   if (!title.empty())
+      out << R"(<p class="tableTitle">)" << title << "</p>\n";
+}
+//---------------------------------------------------------------------------
+static void writeFunctionTable(OutputFile& out, span<const FunctionRow> rows, bool withFiles, string_view title = {})
+// Write a sortable table of functions
+{
+   writeTableTitle(out, title);
+   out << R"(<center>
+  <table class="sortable" width="80%" cellpadding="2" cellspacing="1" border="0">
+    <thead><tr>)"
+       << (withFiles ? R"(<td class="tableHead">File</td>)" : "") << R"(<td class="tableHead">Function</td><td class="tableHead">Line</td><td class="tableHead">Calls</td><td class="tableHead">Regions</td></tr></thead>
+    <tbody>
+)";
+   for (auto& r : rows) {
+      auto& f = *r.function;
+      unsigned perc = computePerc(f.coveredRegions, f.regions);
+      const char* qc = (perc >= 750) ? "Hi" : ((perc >= 350) ? "Med" : "Lo");
+      out << "<tr>";
+      if (withFiles) {
+         out << R"(<td class="coverFunction">)";
+         highlightFilename(out, r.prettyName);
+         out << "</td>";
+      }
+      out << R"(<td class="coverFunction"><a href=")" << r.htmlFile << "#L" << f.line << "\">";
+      escapeHtml(out, f.name);
+      out << R"(</a></td><td class="coverNum">)" << f.line << R"(</td><td class="cover)" << (f.executionCount ? "Hi" : "Lo") << "\">" << f.executionCount << R"(</td><td class="cover)" << qc << R"(" data-sort=")" << perc << "\">" << formatPerc(perc) << "&nbsp;%&nbsp;(" << f.coveredRegions << "&nbsp;/&nbsp;" << f.regions << ")</td></tr>\n";
+   }
+   out << R"(    </tbody>
+  </table>
+</center>
+<br/>
+)";
+}
+//---------------------------------------------------------------------------
+/// A row of a table of hot lines
+struct HotLineRow {
+   HotLine hotLine;
+   /// The page, the name and the path of the file, if the table spans several files
+   string_view htmlFile, prettyName, path;
+};
+//---------------------------------------------------------------------------
+static void writeHotLineTable(OutputFile& out, span<const HotLineRow> rows, bool withFiles, string_view title)
+// Write a sortable table of frequently executed lines
+{
+   writeTableTitle(out, title);
+   out << R"(<center>
+  <table class="sortable" width="80%" cellpadding="2" cellspacing="1" border="0">
+    <thead><tr>)"
+       << (withFiles ? R"(<td class="tableHead">File</td>)" : "") << R"(<td class="tableHead">Line</td><td class="tableHead">Count</td></tr></thead>
+    <tbody>
+)";
+   for (auto& r : rows) {
+      out << "<tr>";
+      if (withFiles) {
+         out << R"(<td class="coverFunction">)";
+         highlightFilename(out, r.prettyName);
+         out << "</td>";
+      }
+      out << R"(<td class="coverNum"><a href=")" << r.htmlFile << "#L" << r.hotLine.line << "\">" << r.hotLine.line << R"(</a></td><td class="coverNum"><span class="heat)" << getHeatLevel(r.hotLine.count) << "\">" << r.hotLine.count << "</span></td></tr>\n";
+   }
+   out << R"(    </tbody>
+  </table>
+</center>
+<br/>
+)";
+}
+//---------------------------------------------------------------------------
+static vector<FunctionRow> getHotFunctions(span<const FunctionRow> functions, unsigned limit)
+// Find the most frequently called functions
+{
+   vector<FunctionRow> result;
+   for (auto& f : functions)
+      if (f.function->executionCount)
+         result.push_back(f);
+   auto isHotter = [](const FunctionRow& a, const FunctionRow& b) {
+      if (a.function->executionCount != b.function->executionCount)
+         return a.function->executionCount > b.function->executionCount;
+      if (a.prettyName != b.prettyName)
+         return a.prettyName < b.prettyName;
+      return a.function->line < b.function->line;
+   };
+   if (result.size() > limit) {
+      partial_sort(result.begin(), result.begin() + limit, result.end(), isHotter);
+      result.resize(limit);
+   } else {
+      sort(result.begin(), result.end(), isHotter);
+   }
+   return result;
+}
+//---------------------------------------------------------------------------
+static void writeJsonString(OutputFile& out, string_view s)
+// Write a string as JSON literal
+{
+   out << '"';
+   for (char c : s) {
+      if ((c == '"') || (c == '\\')) {
+         out << '\\' << c;
+      } else if (static_cast<unsigned char>(c) < 0x20) {
+         static constexpr char hex[] = "0123456789abcdef";
+         out << "\\u00" << hex[c >> 4] << hex[c & 15];
+      } else {
+         out << c;
+      }
+   }
+   out << '"';
+}
+//---------------------------------------------------------------------------
+static void writeHeader(OutputFile& out, const string& binaryName, const string& timestamp, const string& prettyFile, const CoverageStats& stats, bool hasBaseline, bool hasPatch, bool hasSearch)
 // Write the HTML header
 {
    out << R"(<!DOCTYPE html>
@@ -422,8 +1775,8 @@ static void writeHeader(ostream& out, const string& binaryName, const string& ti
                       <td class="headerItem" width="20%">Command:</td>
                       <td class="headerValue" width="80%" colspan=6>)";
    escapeHtml(out, binaryName);
-   out << "</td>" << endl;
-   unsigned perc = computePerc(hitLines, executableLines);
+   out << "</td>\n";
+   unsigned perc = computePerc(stats.hitLines, stats.executableLines);
    out << R"(        </tr>
                      <tr>
                      <td class="headerItem" width="20%">Date:</td>
@@ -433,27 +1786,51 @@ static void writeHeader(ostream& out, const string& binaryName, const string& ti
                      <td width="5%"></td>
                      <td class="headerItem" width="20%">Instrumented&nbsp;lines:</td>
                      <td class="headerValue" width="10%">)"
-       << executableLines << R"(</td>
+       << stats.executableLines << R"(</td>
                    </tr>
                    <tr>
                    <td class="headerItem" width="20%">Code&nbsp;covered:
                    <td class="headerValue" width="15%">)"
-       << (perc / 10) << "." << (perc % 10) << R"( %</td>
+       << formatPerc(perc) << R"( %</td>
                    <td width="5%"></td>
                      <td class="headerItem" width="20%">Executed&nbsp;lines:</td>
                      <td class="headerValue" width="10%">)"
-       << hitLines << R"(</td>
-                   </tr>)"
-       << (hasSearch ? R"(<tr><td class="headerItem" width="20%">Search:</td><td width="80%" colspan="4"><input type="text" id="search" value="" /></td></tr>)" : "") <<
-      R"(</table>
+       << stats.hitLines << R"(</td>
+                   </tr>)";
+   // Branch and MC/DC coverage is only shown if the code was compiled with it, changes only if there is a baseline
+   auto writeRow = [&](string_view name1, ShortString value1, string_view name2, ShortString value2) {
+      out << R"(
+                   <tr>
+                   <td class="headerItem" width="20%">)"
+          << name1 << R"(:
+                   <td class="headerValue" width="15%">)"
+          << value1 << R"(</td>
+                   <td width="5%"></td>
+                     <td class="headerItem" width="20%">)"
+          << name2 << R"(:</td>
+                     <td class="headerValue" width="10%">)"
+          << value2 << R"(</td>
+                   </tr>)";
+   };
+   if (stats.branches)
+      writeRow("Branches&nbsp;covered", formatPerc(computePerc(stats.hitBranches, stats.branches)) << " %", "Executed&nbsp;branches", ShortString() << stats.hitBranches << " / " << stats.branches);
+   if (stats.conditions)
+      writeRow("MC/DC&nbsp;covered", formatPerc(computePerc(stats.coveredConditions, stats.conditions)) << " %", "Covered&nbsp;conditions", ShortString() << stats.coveredConditions << " / " << stats.conditions);
+   if (hasBaseline) {
+      writeRow("Baseline&nbsp;covered", formatPerc(computePerc(stats.baselineHitLines, stats.baselineExecutableLines)) << " %", "Changed&nbsp;counts", ShortString() << stats.changedLines);
+      writeRow("Newly&nbsp;covered", ShortString() << stats.newlyCovered, "Newly&nbsp;uncovered", ShortString() << stats.newlyUncovered);
+   }
+   if (hasPatch)
+      writeRow("Patch&nbsp;covered", formatPerc(computePerc(stats.patchHitLines, stats.patchExecutableLines)) << " %", "Executed&nbsp;changed&nbsp;lines", ShortString() << stats.patchHitLines << " / " << stats.patchExecutableLines);
+   out << (hasSearch ? R"(<tr><td class="headerItem" width="20%">Search:</td><td width="80%" colspan="4"><form action="files.html"><input type="text" id="search" name="search" value="" autofocus /></form></td></tr>)" : "") << R"(</table>
                </td>
              </tr>
              <tr><td class="ruler"></td></tr>
-           </table>)"
-       << endl;
+           </table>
+)";
 }
 //---------------------------------------------------------------------------
-static void writeFooter(ostream& out, bool hasSearch)
+static void writeFooter(OutputFile& out, bool hasFileList)
 // Write the HTML footer
 {
    out << R"(<table width="100%" border="0" cellspacing="0" cellpadding="0">
@@ -461,71 +1838,171 @@ static void writeFooter(ostream& out, bool hasSearch)
              <tr><td class="versionInfo">Generated by: llvmcov2html</td></tr>
            </table>
            <br/>)"
-       << (hasSearch ? R"(
-<script>
-   // Build lookup table with all files by parsing html table
-   const mainTable = document.getElementById("main");
-   let files = {}
-   for (let el of mainTable.getElementsByClassName("coverFile")) {
-       const name = el.innerText.substr(6).toLowerCase();
-       files[name] = el.parentNode;
-   }
-
-   // Add search oninput to field
-   const search = (needle) => {
-       for (let key in files) {
-           const found = needle.toLowerCase().split(" ").map(el => key.includes(el)).every(t => t);
-           files[key].style.display = found ? "table-row" : "none";
-       }
-   };
-
-   document.getElementById("search").addEventListener("input", (e) => {
-       search(e.value || e.target.value);
-   });
-
-   // Hitting return opens the first in the list
-   document.getElementById("search").addEventListener("keydown", (e) => {
-      if(e.keyCode == 13) { // Enter
-         mainTable.querySelector('tr:not([style*="display: none"]) a').click();
-      }
-   });
-
-   // Focus on search field on load
-   document.addEventListener('DOMContentLoaded', (e) => {
-      document.getElementById("search").focus();
-   });
-</script>)" :
-                       "")
+       << (hasFileList ? R"(
+<script src="filelist.js"></script>)" :
+                         "")
        << R"(
+<script src="llvmcov2html.js"></script>
            </body>
-           </html>)"
-       << endl;
+           </html>
+)";
 }
 //---------------------------------------------------------------------------
-static bool processFile(CoverageList& coverageList, const string& outFile, llvm::coverage::CoverageMapping& coverage, llvm::StringRef file, const vector<string>& extraIgnore, unsigned& hitLines, unsigned& executableLines, const string& binaryName, const string& timestamp, const string& prettyFile)
-// Process a file
+/// An event of a Chrome trace
+struct TraceEvent {
+   string name;
+   unsigned thread;
+   uint64_t begin, duration;
+};
+//---------------------------------------------------------------------------
+/// The counters of a worker for --stats and --trace
+struct WorkerStats {
+   /// The worker
+   unsigned worker = 0;
+   /// Collect trace events?
+   bool trace = false;
+   /// The files that were rendered, were unchanged, were excluded, or had no coverage
+   unsigned rendered = 0, unchanged = 0, excluded = 0, noCoverage = 0;
+   /// The lines and fragments that were handled
+   uint64_t lines = 0, fragments = 0;
+   /// The time spent querying the coverage, computing the lines, and emitting the pages to the writer, in microseconds
+   uint64_t queryTime = 0, computeTime = 0, emitTime = 0;
+   /// The trace events
+   vector<TraceEvent> events;
+
+   /// Finish a step that started at begin. Returns the current time
+   uint64_t finishStep(uint64_t& total, const char* name, uint64_t begin) {
+      uint64_t now = getMicroseconds();
+      total += now - begin;
+      if (trace) events.push_back({name, worker, begin, now - begin});
+      return now;
+   }
+};
+//---------------------------------------------------------------------------
+/// The settings and shared state of a run, used by all workers
+struct RenderContext {
+   /// The coverage, and the baseline if any
+   llvm::coverage::CoverageMapping& coverage;
+   llvm::coverage::CoverageMapping* baseline;
+   /// The exclusion markers
+   const MarkerScanner& markerScanner;
+   /// The command and profile date shown in the headers
+   const string& binaryName;
+   const string& timestamp;
+   /// The number of hot lines in heatmap mode, 0 otherwise
+   unsigned heatmap;
+   /// The relative change of an execution count that is marked, in percent
+   unsigned deltaThreshold;
+   /// The background writer for the pages
+   AsyncWriter& writer;
+};
+//---------------------------------------------------------------------------
+static bool processFile(const RenderContext& context, llvm::StringRef file, const string& outFile, const string& prettyFile, span<const FunctionInfo> functions, const LineSet* patchLines, const Manifest::Entry* previous, Manifest::Entry* entry, HitList& lines, CoverageStats& stats, vector<HotLine>& hotLines, WorkerStats& workerStats)
+// Process a file. In incremental mode entry receives the state of the file, and unchanged files are skipped. In heatmap mode hotLines receives the most frequently executed lines. With a baseline the changes are shown, with patch lines their coverage
 {
-   // Check the source code
-   stringstream code;
-   processCode(code, coverageList, coverage, file, extraIgnore, hitLines, executableLines);
-   if (!executableLines)
+   stats = {};
+   uint64_t begin = getMicroseconds();
+   MappedFile source(file.str());
+   if (!source.isOpen())
       return false;
+   auto data = context.coverage.getCoverageForFile(file);
+   llvm::coverage::CoverageData baselineData;
+   if (context.baseline)
+      baselineData = context.baseline->getCoverageForFile(file);
+   begin = workerStats.finishStep(workerStats.queryTime, "query", begin);
+
+   // Skip the file if neither the source nor the coverage changed
+   if (entry) {
+      entry->sourceHash = llvm::xxh3_64bits(llvm::StringRef(source.content().data(), source.content().size()));
+      entry->coverageHash = hashCoverage(data);
+      if (context.baseline) {
+         uint64_t hashes[2] = {entry->coverageHash, hashCoverage(baselineData)};
+         entry->coverageHash = llvm::xxh3_64bits(llvm::ArrayRef(reinterpret_cast<const uint8_t*>(hashes), sizeof(hashes)));
+      }
+      if (previous && (previous->sourceHash == entry->sourceHash) && (previous->coverageHash == entry->coverageHash) && ((!previous->stats.executableLines) || (access(outFile.c_str(), F_OK) == 0))) {
+         stats = entry->stats = previous->stats;
+         hotLines = entry->hotLines = previous->hotLines;
+         if (!stats.executableLines)
+            return false;
+         lines = previous->lines;
+         ++workerStats.unchanged;
+         return true;
+      }
+   }
+
+   // Compute the coverage of all lines
+   SourceFile sourceFile(source.content(), context.markerScanner);
+   LineCoverage lineCoverage(sourceFile, data);
+   stats = lineCoverage.stats;
+   unique_ptr<LineCoverage> baselineCoverage;
+   vector<LineDelta> deltas;
+   if (context.baseline) {
+      baselineCoverage = make_unique<LineCoverage>(sourceFile, baselineData);
+      deltas = computeDeltas(lineCoverage, *baselineCoverage, context.deltaThreshold, stats);
+   }
+   if (patchLines) {
+      patchLines->forEach([&](unsigned lineNo) {
+         if ((!lineNo) || (lineNo > lineCoverage.lines.size()))
+            return;
+         auto& line = lineCoverage.lines[lineNo - 1];
+         if (line.candidates) {
+            ++stats.patchExecutableLines;
+            if (line.hitCandidates) ++stats.patchHitLines;
+         }
+      });
+   }
+   if (context.heatmap)
+      hotLines = collectHotLines(lineCoverage, context.heatmap);
+   if (entry) {
+      entry->stats = stats;
+      entry->hotLines = hotLines;
+   }
+   workerStats.lines += lineCoverage.lines.size();
+   workerStats.fragments += lineCoverage.fragments.size();
+   if (!stats.executableLines)
+      return false;
+   collectLines(lines, lineCoverage);
+   begin = workerStats.finishStep(workerStats.computeTime, "compute", begin);
 
    // Write the header
-   ofstream out(outFile);
-   writeHeader(out, binaryName, timestamp, prettyFile, hitLines, executableLines, false);
+   OutputFile out(outFile, &context.writer);
+   writeHeader(out, context.binaryName, context.timestamp, prettyFile, stats, context.baseline, patchLines, false);
 
-   // Write the code
-   out << R"(<pre class="source">)" << endl;
-   out << code.str();
-   out << "</pre>" << endl;
+   // Write the functions
+   vector<FunctionRow> rows;
+   rows.reserve(functions.size());
+   for (auto& f : functions)
+      rows.push_back({&f, {}, {}, {}});
+   if (context.heatmap) {
+      vector<HotLineRow> hotLineRows;
+      for (auto& h : hotLines)
+         hotLineRows.push_back({h, {}, {}, {}});
+      writeHotLineTable(out, hotLineRows, false, "Hottest lines");
+      writeFunctionTable(out, getHotFunctions(rows, context.heatmap), false, "Hottest functions");
+   }
+   if (!rows.empty())
+      writeFunctionTable(out, rows, false, context.heatmap ? "All functions" : "");
+
+   // Write the code, with anchors for the functions and hot lines
+   vector<unsigned> anchors;
+   for (auto& f : functions)
+      anchors.push_back(f.line);
+   for (auto& h : hotLines)
+      anchors.push_back(h.line);
+   sort(anchors.begin(), anchors.end());
+   out << R"(<pre class="source">)" << '\n';
+   writeSource(out, lineCoverage, anchors, context.heatmap, baselineCoverage.get(), deltas, patchLines);
+   out << "</pre>\n";
 
    // Write the footer
    writeFooter(out, false);
+   out.close();
+   workerStats.finishStep(workerStats.emitTime, "emit", begin);
+   ++workerStats.rendered;
    return true;
 }
 //---------------------------------------------------------------------------
-static void constructBar(ostream& out, unsigned perc)
+static void constructBar(OutputFile& out, unsigned perc)
 // Construct a percentage bar
 {
    double percent = perc / 10.0;
@@ -553,12 +2030,7 @@ static void writeExtras(string targetDir)
 // Write extra files
 {
    {
-      string outputFile = targetDir + "llvmcov2html.css";
-      ofstream out(outputFile);
-      if (!out.is_open()) {
-         cerr << "unable to write " << outputFile << endl;
-         exit(1);
-      }
+      OutputFile out(targetDir + "llvmcov2html.css");
       out << R"(/* Based upon the lcov CSS style, style files can be reused */
 :root {
    --lowcov: #cc3232;
@@ -605,9 +2077,13 @@ td.headerValue { text-align: left; color: var(--highlight); font-family: sans-se
 td.versionInfo { text-align: center; padding-top:  2px; }
 pre.source { font-family: monospace; white-space: pre; color: var(--code); }
 span.lineNum { color: var(--linenum); background-color: var(--tablebg); }
+span.lineNumChanged { color: var(--bg); background-color: var(--highlight); }
 span.lineCov { color: var(--highcovtext); background-color: var(--highcovtextbg); }
 span.linePartCov { color: var(--medcovtext); background-color: var(--medcovtextbg); }
 span.lineNoCov { color: var(--lowcovtext); background-color: var(--lowcovtextbg); }
+span.branchCov { color: var(--linenum); }
+span.branchPartCov { color: var(--medcovtext); background-color: var(--medcovtextbg); }
+span.branchNoCov { color: var(--lowcovtext); background-color: var(--lowcovtextbg); }
 td.tableHead { text-align: center; color: var(--fg); background-color: var(--highlight); font-family: sans-serif; font-size: 120%; font-weight: bold; }
 td.coverFile { text-align: left; padding-left: 10px; padding-right: 20px; color: var(--fg); background-color: var(--tablebg); font-family: monospace; }
 td.coverBar { padding-left: 10px; padding-right: 10px; background-color: var(--tablebg); }
@@ -616,26 +2092,699 @@ td.coverPer { font-weight: bold; }
 td.coverHi { text-align: right; padding-left: 10px; padding-right: 10px; background-color: var(--highcov); }
 td.coverMed { text-align: right; padding-left: 10px; padding-right: 10px; background-color: var(--medcov); }
 td.coverLo { text-align: right; padding-left: 10px; padding-right: 10px; background-color: var(--lowcov); color: var(--fg); }
+td.coverFunction { text-align: left; padding-left: 10px; padding-right: 20px; color: var(--fg); background-color: var(--tablebg); font-family: monospace; }
+td.coverNum { text-align: right; padding-left: 10px; padding-right: 10px; background-color: var(--tablebg); }
+table.sortable thead td { cursor: pointer; }
+span.deltaNew { color: var(--highcovtext); font-weight: bold; }
+span.deltaLost { color: var(--lowcovtext); font-weight: bold; }
+span.deltaChanged { color: var(--medcovtext); font-weight: bold; }
+p.tableTitle { text-align: center; font-family: sans-serif; font-weight: bold; }
+span.heat0 { background-color: color-mix(in srgb, #ff5000 5%, transparent); }
+span.heat1 { background-color: color-mix(in srgb, #ff5000 10%, transparent); }
+span.heat2 { background-color: color-mix(in srgb, #ff5000 15%, transparent); }
+span.heat3 { background-color: color-mix(in srgb, #ff5000 20%, transparent); }
+span.heat4 { background-color: color-mix(in srgb, #ff5000 30%, transparent); }
+span.heat5 { background-color: color-mix(in srgb, #ff5000 40%, transparent); }
+span.heat6 { background-color: color-mix(in srgb, #ff5000 50%, transparent); }
+span.heat7 { background-color: color-mix(in srgb, #ff5000 60%, transparent); }
+span.heat8 { background-color: color-mix(in srgb, #ff5000 75%, transparent); }
+span.heat9 { background-color: color-mix(in srgb, #ff5000 90%, transparent); }
 span.progBar { diplay: inline-block; height: 10px }
-span.filename { font-weight: bold; })";
+span.filename { font-weight: bold; }
+div.fileList { width: 80%; height: 75vh; overflow-y: auto; }
+div.fileList td { white-space: nowrap; }
+div.fileList thead td { position: sticky; top: 0; })";
+      out.close();
+   }
+   {
+      OutputFile out(targetDir + "llvmcov2html.js");
+      out << R"(// Sort tables by a column when clicking on its head, clicking again reverses the order
+for (const table of document.querySelectorAll("table.sortable")) {
+   const heads = table.tHead.rows[0].cells;
+   for (let column = 0; column < heads.length; column++) {
+      heads[column].addEventListener("click", () => {
+         const body = table.tBodies[0];
+         const rows = Array.from(body.rows);
+         const ascending = (table.dataset.column != column) || (table.dataset.order != "asc");
+         const key = (row) => row.cells[column].dataset.sort ?? row.cells[column].innerText;
+         rows.sort((a, b) => {
+            const x = key(a), y = key(b);
+            const c = (isNaN(x) || isNaN(y)) ? x.localeCompare(y) : (x - y);
+            return ascending ? c : -c;
+         });
+         body.append(...rows);
+         table.dataset.column = column;
+         table.dataset.order = ascending ? "asc" : "desc";
+      });
+   }
+}
+
+// Show the list of all files in files.html. Only the visible rows are created, the search scans the prebuilt index
+// All names are scoped to the block, so that the script does not fail if a page should load it twice
+if (document.getElementById("fileList") && (typeof llvmcov2htmlFiles !== "undefined")) {
+   const fileList = document.getElementById("fileList");
+   const data = llvmcov2htmlFiles, files = data.files, searchIndex = data.search;
+   const table = fileList.querySelector("table"), searchField = document.getElementById("search");
+   const computePerc = (hit, total) => (hit && total) ? Math.max(Math.floor(hit * 1000 / total), 1) : 0;
+   const formatPerc = (perc) => Math.floor(perc / 10) + "." + (perc % 10);
+   const getQualityClass = (perc) => (perc >= 750) ? "coverHi" : ((perc >= 350) ? "coverMed" : "coverLo");
+   const escapeHtml = (s) => s.replace(/[&<>"]/g, (c) => ({"&": "&amp;", "<": "&lt;", ">": "&gt;", '"': "&quot;"})[c]);
+   const writeCount = (hit, total) => {
+      if (!total) return `<td class="coverBar"></td>`;
+      const perc = computePerc(hit, total);
+      return `<td class="${getQualityClass(perc)}">${formatPerc(perc)}&nbsp;%&nbsp;(${hit}&nbsp;/&nbsp;${total})</td>`;
+   };
+   const writeChange = (f) => {
+      const change = computePerc(f[2], f[3]) - computePerc(f[8], f[9]);
+      return `<td class="coverNum">${(change < 0) ? "-" : "+"}${formatPerc(Math.abs(change))}&nbsp;%&nbsp;(+${f[10]}&nbsp;/&nbsp;-${f[11]})</td>`;
+   };
+   const writeFile = (f) => {
+      const pos = f[0].lastIndexOf("/") + 1;
+      return `<td class="coverFile"><a href="${escapeHtml(f[1])}">${escapeHtml(f[0].substr(0, pos))}<span class="filename">${escapeHtml(f[0].substr(pos))}</span></a></td>`;
+   };
+
+   // The columns as head, sort key, and cell
+   const columns = [["File", (f) => f[0], writeFile], ["Coverage", (f) => computePerc(f[2], f[3]), (f) => writeCount(f[2], f[3])]];
+   if (data.branches) columns.push(["Branches", (f) => computePerc(f[4], f[5]), (f) => writeCount(f[4], f[5])]);
+   if (data.conditions) columns.push(["MC/DC", (f) => computePerc(f[6], f[7]), (f) => writeCount(f[6], f[7])]);
+   if (data.baseline) columns.push(["Change", (f) => computePerc(f[2], f[3]) - computePerc(f[8], f[9]), writeChange]);
+   if (data.patch) columns.push(["Patch", (f) => computePerc(f[12], f[13]), (f) => writeCount(f[12], f[13])]);
+
+   // The files in display order, and the ones matching the search
+   let order = files.map((f, id) => id), shown = order, sortColumn = -1, ascending = true;
+   const body = table.createTBody();
+   let rowHeight = 20;
+   const render = () => {
+      const first = Math.max(Math.floor(fileList.scrollTop / rowHeight) - 10, 0);
+      const last = Math.min(first + Math.ceil(fileList.clientHeight / rowHeight) + 20, shown.length);
+      const spacer = (rows) => `<tr><td colspan="${columns.length}" style="height: ${rows * rowHeight}px; padding: 0"></td></tr>`;
+      let html = spacer(first);
+      for (let pos = first; pos < last; pos++)
+         html += "<tr>" + columns.map((c) => c[2](files[shown[pos]])).join("") + "</tr>";
+      body.innerHTML = html + spacer(shown.length - last);
+      // All rows have the same height, it is measured once
+      if ((last > first) && (body.rows[1].offsetHeight != rowHeight) && body.rows[1].offsetHeight) {
+         rowHeight = body.rows[1].offsetHeight;
+         render();
+      }
+   };
+   let renderPending = false;
+   fileList.addEventListener("scroll", () => {
+      if (renderPending) return;
+      renderPending = true;
+      requestAnimationFrame(() => {
+         renderPending = false;
+         render();
+      });
+   });
+
+   // The start of every name within the search index
+   const starts = new Uint32Array(files.length + 1);
+   for (let id = 0, pos = 0; id <= files.length; id++) {
+      starts[id] = pos;
+      pos = searchIndex.indexOf("\n", pos) + 1;
+   }
+   const matches = new Uint8Array(files.length);
+   const search = () => {
+      const terms = searchField.value.toLowerCase().split(" ").filter((t) => t.length);
+      if (!terms.length) {
+         shown = order;
+      } else {
+         // Scan the index for the longest term, the other terms are checked for every hit
+         terms.sort((a, b) => b.length - a.length);
+         matches.fill(0);
+         for (let pos = searchIndex.indexOf(terms[0]); pos >= 0;) {
+            let lower = 0, upper = files.length;
+            while (upper - lower > 1) {
+               const middle = (lower + upper) >> 1;
+               if (starts[middle] <= pos) lower = middle; else upper = middle;
+            }
+            const name = searchIndex.substring(starts[lower], starts[lower + 1] - 1);
+            if (terms.every((t) => name.includes(t))) matches[lower] = 1;
+            pos = searchIndex.indexOf(terms[0], starts[lower + 1]);
+         }
+         shown = order.filter((id) => matches[id]);
+      }
+      fileList.scrollTop = 0;
+      render();
+   };
+
+   // Clicking on a column head sorts by it, clicking again reverses the order
+   const head = table.createTHead().insertRow();
+   columns.forEach((c, column) => {
+      const cell = head.insertCell();
+      cell.className = "tableHead";
+      cell.textContent = c[0];
+      cell.addEventListener("click", () => {
+         ascending = (sortColumn != column) || !ascending;
+         sortColumn = column;
+         const keys = files.map(c[1]);
+         order = files.map((f, id) => id).sort((a, b) => {
+            const x = keys[a], y = keys[b];
+            const result = (x < y) ? -1 : ((x > y) ? 1 : (a - b));
+            return ascending ? result : -result;
+         });
+         search();
+      });
+   });
+
+   // Typing searches, hitting return opens the first file
+   searchField.addEventListener("input", search);
+   searchField.addEventListener("keydown", (e) => {
+      if (e.key == "Enter") {
+         e.preventDefault();
+         if (shown.length) window.location.href = files[shown[0]][1];
+      }
+   });
+   searchField.value = new URLSearchParams(window.location.search).get("search") ?? "";
+   search();
+}
+)";
+      out.close();
+   }
+}
+//---------------------------------------------------------------------------
+class WorkStealingPool {
+   private:
+   /// The task queue of a worker
+   struct Queue {
+      mutex lock;
+      deque<unsigned> tasks;
+   };
+   /// The queues
+   vector<Queue> queues;
+
+   /// Take a task from the front of our own queue
+   bool pop(unsigned worker, unsigned& task);
+   /// Steal a task from the back of another queue
+   bool steal(unsigned worker, unsigned& task);
+
+   public:
+   /// Constructor
+   explicit WorkStealingPool(unsigned workers) : queues(workers ? workers : 1) {}
+
+   /// Run task(worker, index) for every index in [0, count)
+   template <class T>
+   void run(unsigned count, const T& task);
+};
+//---------------------------------------------------------------------------
+bool WorkStealingPool::pop(unsigned worker, unsigned& task)
+// Take a task from the front of our own queue
+{
+   auto& q = queues[worker];
+   lock_guard guard(q.lock);
+   if (q.tasks.empty()) return false;
+   task = q.tasks.front();
+   q.tasks.pop_front();
+   return true;
+}
+//---------------------------------------------------------------------------
+bool WorkStealingPool::steal(unsigned worker, unsigned& task)
+// Steal a task from the back of another queue
+{
+   for (unsigned index = 1, limit = queues.size(); index < limit; ++index) {
+      auto& q = queues[(worker + index) % limit];
+      lock_guard guard(q.lock);
+      if (q.tasks.empty()) continue;
+      task = q.tasks.back();
+      q.tasks.pop_back();
+      return true;
+   }
+   return false;
+}
+//---------------------------------------------------------------------------
+template <class T>
+void WorkStealingPool::run(unsigned count, const T& task)
+// Run task(worker, index) for every index in [0, count)
+{
+   // Hand out contiguous blocks, workers steal from the end of other blocks once they run dry
+   unsigned workers = queues.size();
+   for (unsigned worker = 0; worker < workers; ++worker)
+      for (unsigned index = (static_cast<uint64_t>(count) * worker) / workers, limit = (static_cast<uint64_t>(count) * (worker + 1)) / workers; index < limit; ++index)
+         queues[worker].tasks.push_back(index);
+
+   auto work = [&](unsigned worker) {
+      unsigned index;
+      while (pop(worker, index) || steal(worker, index))
+         task(worker, index);
+   };
+   if (workers == 1) {
+      work(0);
+      return;
    }
+   vector<thread> threads;
+   for (unsigned worker = 1; worker < workers; ++worker)
+      threads.emplace_back(work, worker);
+   work(0);
+   for (auto& t : threads)
+      t.join();
 }
 //---------------------------------------------------------------------------
-static string getFileTimestamp(const string& file)
-// Get the timestamp of a file
+static vector<string> findRawProfiles(const string& profile)
+// Find the raw profiles if the profile is a directory, a glob pattern, or a .profraw file. Returns an empty list for an indexed profile
 {
+   vector<string> result;
    struct stat s;
-   if (stat(file.c_str(), &s) != 0)
+   if (stat(profile.c_str(), &s) == 0) {
+      if (S_ISDIR(s.st_mode)) {
+         // Collect all raw profiles within the directory
+         DIR* dir = opendir(profile.c_str());
+         if (!dir) {
+            cerr << "unable to read " << profile << endl;
+            exit(1);
+         }
+         string prefix = profile;
+         if (prefix.back() != '/') prefix += '/';
+         while (auto entry = readdir(dir)) {
+            string_view name = entry->d_name;
+            if ((name.size() > 8) && (name.substr(name.size() - 8) == ".profraw"))
+               result.push_back(prefix + entry->d_name);
+         }
+         closedir(dir);
+         sort(result.begin(), result.end());
+      } else if ((profile.size() > 8) && (profile.substr(profile.size() - 8) == ".profraw")) {
+         result.push_back(profile);
+      } else {
+         return result;
+      }
+   } else if (profile.find_first_of("*?[") != string::npos) {
+      // Expand the glob pattern
+      glob_t matches;
+      if (glob(profile.c_str(), 0, nullptr, &matches) == 0)
+         for (size_t index = 0; index < matches.gl_pathc; ++index)
+            result.push_back(matches.gl_pathv[index]);
+      globfree(&matches);
+   } else {
+      return result;
+   }
+   if (result.empty()) {
+      cerr << "no raw profiles found in " << profile << endl;
+      exit(1);
+   }
+   return result;
+}
+//---------------------------------------------------------------------------
+static unique_ptr<llvm::MemoryBuffer> mergeRawProfiles(span<const string> rawProfiles, unsigned jobs)
+// Merge raw profiles into an indexed profile in memory
+{
+   // Every worker merges the files it picks up into its own writer
+   jobs = max(min<unsigned>(jobs, rawProfiles.size()), 1u);
+   WorkStealingPool pool(jobs);
+   vector<llvm::InstrProfWriter> writers(jobs);
+   vector<unsigned> warnings(jobs);
+   pool.run(rawProfiles.size(), [&](unsigned worker, unsigned index) {
+      auto fs = llvm::vfs::getRealFileSystem();
+      auto& fileName = rawProfiles[index];
+      auto reader = llvm::InstrProfReader::create(fileName, *fs);
+      if (!reader) {
+         cerr << "unable to read " << fileName << ": " << llvm::toString(reader.takeError()) << endl;
+         exit(1);
+      }
+      auto& writer = writers[worker];
+      if (auto error = writer.mergeProfileKind((*reader)->getProfileKind())) {
+         cerr << "unable to merge " << fileName << ": " << llvm::toString(move(error)) << endl;
+         exit(1);
+      }
+      for (auto& record : **reader)
+         writer.addRecord(move(record), 1, [&](llvm::Error error) {
+            llvm::consumeError(move(error));
+            ++warnings[worker];
+         });
+      if ((*reader)->hasError()) {
+         cerr << "unable to read " << fileName << ": " << llvm::toString((*reader)->getError()) << endl;
+         exit(1);
+      }
+   });
+
+   // Combine the writers pairwise, each round halves the number of writers
+   for (unsigned step = 1; step < jobs; step *= 2) {
+      pool.run((jobs + 2 * step - 1) / (2 * step), [&](unsigned worker, unsigned index) {
+         unsigned target = 2 * step * index, source = target + step;
+         if (source >= jobs) return;
+         if (auto error = writers[target].mergeProfileKind(writers[source].getProfileKind())) {
+            cerr << "unable to merge the raw profiles: " << llvm::toString(move(error)) << endl;
+            exit(1);
+         }
+         writers[target].mergeRecordsFromWriter(move(writers[source]), [&](llvm::Error error) {
+            llvm::consumeError(move(error));
+            ++warnings[worker];
+         });
+      });
+   }
+
+   unsigned warningCount = 0;
+   for (auto w : warnings) warningCount += w;
+   if (warningCount)
+      cerr << "warning: " << warningCount << " profile records could not be merged exactly" << endl;
+   return writers.front().writeBuffer();
+}
+//---------------------------------------------------------------------------
+static unique_ptr<llvm::coverage::CoverageMapping> loadCoverage(const vector<string>& objectFile, const string& profileFile, span<const string> rawProfiles, unsigned jobs)
+// Load the coverage. Raw profiles are merged in memory first
+{
+   // CoverageMapping::load reads the object files one after the other, it offers no way to load them concurrently
+   llvm::IntrusiveRefCntPtr<llvm::vfs::FileSystem> fs = llvm::vfs::getRealFileSystem();
+   string profileName = profileFile;
+   if (!rawProfiles.empty()) {
+      // The merged profile is provided by an in-memory file system on top of the real one
+      profileName = "/llvmcov2html-merged.profdata";
+      auto memory = llvm::makeIntrusiveRefCnt<llvm::vfs::InMemoryFileSystem>();
+      memory->addFile(profileName, 0, mergeRawProfiles(rawProfiles, jobs));
+      auto overlay = llvm::makeIntrusiveRefCnt<llvm::vfs::OverlayFileSystem>(fs);
+      overlay->pushOverlay(memory);
+      fs = overlay;
+   }
+   vector<llvm::StringRef> objectFiles(objectFile.begin(), objectFile.end());
+   auto res = llvm::coverage::CoverageMapping::load(objectFiles, profileName, *fs);
+   if (!res) {
+      cerr << "unable to load profile" << endl;
+      exit(1);
+   }
+   return move(*res);
+}
+//---------------------------------------------------------------------------
+/// Streams the hit and missed lines to disk instead of keeping them in memory. Every worker appends to its
+/// own spool files, which are combined in file order at the end
+class LineListSpool {
+   private:
+   /// The position of the lines of a file within the spool files
+   struct Range {
+      unsigned worker = 0;
+      uint64_t begin = 0, end = 0;
+   };
+   /// The target directory
+   string targetDir;
+   /// The number of workers
+   unsigned workers;
+   /// The spool files of all workers
+   vector<unique_ptr<OutputFile>> hits, misses;
+   /// The positions of the lines, by file index
+   vector<Range> hitRanges, missRanges;
+
+   /// The name of a spool file
+   string getSpoolName(const char* name, unsigned worker) const;
+   /// Combine the spool files into the final file
+   void combine(const char* name, const vector<Range>& ranges);
+
+   public:
+   /// Constructor
+   LineListSpool(string targetDir, unsigned workers, unsigned files);
+
+   /// Write the lines of a file
+   void add(unsigned worker, unsigned index, string_view file, const HitList& lines);
+   /// Write the hits and notreached files
+   void finish();
+};
+//---------------------------------------------------------------------------
+LineListSpool::LineListSpool(string targetDir, unsigned workers, unsigned files)
+   : targetDir(move(targetDir)), workers(workers), hitRanges(files), missRanges(files)
+// Constructor
+{
+   for (unsigned worker = 0; worker < workers; ++worker) {
+      hits.push_back(make_unique<OutputFile>(getSpoolName("hits", worker)));
+      misses.push_back(make_unique<OutputFile>(getSpoolName("notreached", worker)));
+   }
+}
+//---------------------------------------------------------------------------
+string LineListSpool::getSpoolName(const char* name, unsigned worker) const
+// The name of a spool file. With only one worker the files are already in order and no spool is needed
+{
+   if (workers == 1)
+      return targetDir + name;
+   return targetDir + "." + name + ".spool" + to_string(worker);
+}
+//---------------------------------------------------------------------------
+void LineListSpool::add(unsigned worker, unsigned index, string_view file, const HitList& lines)
+// Write the lines of a file
+{
+   auto write = [&](OutputFile& out, Range& range, const LineSet& lines) {
+      range.worker = worker;
+      range.begin = out.tell();
+      writeLines(out, file, lines);
+      range.end = out.tell();
+   };
+   write(*hits[worker], hitRanges[index], lines.hits);
+   write(*misses[worker], missRanges[index], lines.misses);
+}
+//---------------------------------------------------------------------------
+void LineListSpool::combine(const char* name, const vector<Range>& ranges)
+// Combine the spool files into the final file
+{
+   vector<int> fds;
+   for (unsigned worker = 0; worker < workers; ++worker) {
+      fds.push_back(open(getSpoolName(name, worker).c_str(), O_RDONLY | O_CLOEXEC));
+      if (fds.back() < 0) {
+         cerr << "unable to read " << getSpoolName(name, worker) << endl;
+         exit(1);
+      }
+   }
+   OutputFile out(targetDir + name);
+   unique_ptr<char[]> buffer(new char[1 << 20]);
+   for (auto& r : ranges) {
+      for (uint64_t pos = r.begin; pos < r.end;) {
+         ssize_t len = pread(fds[r.worker], buffer.get(), min<uint64_t>(1 << 20, r.end - pos), pos);
+         if (len <= 0) {
+            if ((len < 0) && (errno == EINTR)) continue;
+            cerr << "unable to read " << getSpoolName(name, r.worker) << endl;
+            exit(1);
+         }
+         out << string_view(buffer.get(), len);
+         pos += len;
+      }
+   }
+   out.close();
+   for (unsigned worker = 0; worker < workers; ++worker) {
+      close(fds[worker]);
+      unlink(getSpoolName(name, worker).c_str());
+   }
+}
+//---------------------------------------------------------------------------
+void LineListSpool::finish()
+// Write the hits and notreached files
+{
+   for (auto& f : hits) f->close();
+   for (auto& f : misses) f->close();
+   if (workers > 1) {
+      combine("hits", hitRanges);
+      combine("notreached", missRanges);
+   }
+}
+//---------------------------------------------------------------------------
+static size_t getPeakMemory()
+// The peak resident memory in bytes
+{
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage) != 0)
+      return 0;
+   return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
+//---------------------------------------------------------------------------
+static uint64_t getCpuMicroseconds()
+// The CPU time of all threads in microseconds
+{
+   timespec t;
+   if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t) != 0)
+      return 0;
+   return static_cast<uint64_t>(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+}
+//---------------------------------------------------------------------------
+/// Measures the wall and CPU time of the phases of a run for --stats and --trace
+class PhaseTimer {
+   /// A phase
+   struct Phase {
+      string name;
+      uint64_t begin, wallTime, cpuTime;
+   };
+   /// The phases
+   vector<Phase> phases;
+   /// The start of the run and of the current phase
+   uint64_t runStart, phaseStart, runCpuStart, phaseCpuStart;
+
+   public:
+   /// Constructor. Starts the first phase
+   PhaseTimer() : runStart(getMicroseconds()), phaseStart(runStart), runCpuStart(getCpuMicroseconds()), phaseCpuStart(runCpuStart) {}
+
+   /// Finish the current phase and start the next one. Returns the wall time of the phase in seconds
+   double finish(string name);
+   /// Print the durations
+   void print(ostream& out) const;
+   /// Add the phases to a trace
+   void addEvents(vector<TraceEvent>& events) const;
+};
+//---------------------------------------------------------------------------
+double PhaseTimer::finish(string name)
+// Finish the current phase
+{
+   uint64_t now = getMicroseconds(), cpuNow = getCpuMicroseconds();
+   phases.push_back({move(name), phaseStart, now - phaseStart, cpuNow - phaseCpuStart});
+   phaseStart = now;
+   phaseCpuStart = cpuNow;
+   return phases.back().wallTime / 1e6;
+}
+//---------------------------------------------------------------------------
+void PhaseTimer::print(ostream& out) const
+// Print the durations
+{
+   for (auto& p : phases)
+      out << "phase " << p.name << ": " << (p.wallTime / 1e6) << " s wall, " << (p.cpuTime / 1e6) << " s cpu\n";
+   out << "total: " << ((phaseStart - runStart) / 1e6) << " s wall, " << ((phaseCpuStart - runCpuStart) / 1e6) << " s cpu" << endl;
+}
+//---------------------------------------------------------------------------
+void PhaseTimer::addEvents(vector<TraceEvent>& events) const
+// Add the phases to a trace
+{
+   for (auto& p : phases)
+      events.push_back({p.name, 0, p.begin, p.wallTime});
+}
+//---------------------------------------------------------------------------
+static void writeTrace(const string& fileName, const vector<TraceEvent>& events, unsigned workers)
+// Write a trace in the Chrome trace event format
+{
+   OutputFile out(fileName);
+   out << R"({"traceEvents": [)";
+   bool first = true;
+   for (unsigned worker = 0; worker < workers; ++worker) {
+      out << (first ? "\n" : ",\n") << R"({"name": "thread_name", "ph": "M", "pid": 1, "tid": )" << worker << R"(, "args": {"name": "worker )" << worker << R"("}})";
+      first = false;
+   }
+   for (auto& e : events) {
+      out << (first ? "\n" : ",\n") << R"({"name": )";
+      writeJsonString(out, e.name);
+      out << R"(, "ph": "X", "pid": 1, "tid": )" << e.thread << R"(, "ts": )" << e.begin << R"(, "dur": )" << e.duration << '}';
+      first = false;
+   }
+   out << "\n]}\n";
+   out.close();
+}
+//---------------------------------------------------------------------------
+static string getFileTimestamp(span<const string> files)
+// Get the timestamp of the newest file
+{
+   time_t t = 0;
+   for (auto& file : files) {
+      struct stat s;
+      if (stat(file.c_str(), &s) == 0)
+         t = max(t, s.st_mtime);
+   }
+   if (!t)
       return "";
-   time_t t = s.st_mtime;
    return ctime(&t);
 }
 //---------------------------------------------------------------------------
+/// Decides which source files are part of the report. All rules are compiled once, files are checked before any coverage is queried
+class PathFilter {
+   private:
+   /// A node of the directory trie
+   struct TrieNode {
+      /// The children
+      map<char, unsigned> children;
+      /// Does an excluded directory end here?
+      bool excluded = false;
+   };
+   /// A glob pattern or a regular expression
+   struct Rule {
+      optional<llvm::GlobPattern> glob;
+      optional<llvm::Regex> regex;
+
+      /// Does the rule match a path?
+      bool matches(string_view path) const { return glob ? glob->match({path.data(), path.size()}) : regex->match({path.data(), path.size()}); }
+   };
+
+   /// The trie of excluded directories, relative to the project root
+   vector<TrieNode> trie{1};
+   /// The glob patterns. llvm::GlobPattern keeps its literal prefix as a StringRef into the pattern instead of copying it, thus the
+   /// pattern must outlive the rule and must not move. Regular expressions are compiled into their own storage and need no copy
+   deque<string> globPatterns;
+   /// The exclude and include rules
+   vector<Rule> excludes, includes;
+
+   public:
+   /// Exclude a directory, relative to the project root
+   void excludeDir(string_view dir);
+   /// Add a rule. Patterns starting with "regex:" are regular expressions that match anywhere within the path, all others are globs
+   /// that must match the whole path. Returns false for invalid patterns
+   bool addRule(string_view pattern, bool include);
+
+   /// Are there any rules?
+   bool empty() const { return (trie.size() == 1) && excludes.empty() && includes.empty(); }
+   /// Is a file part of the report?
+   bool accepts(string_view path, string_view projectRoot) const;
+};
+//---------------------------------------------------------------------------
+void PathFilter::excludeDir(string_view dir)
+// Exclude a directory
+{
+   unsigned node = 0;
+   for (char c : dir) {
+      auto iter = trie[node].children.find(c);
+      if (iter == trie[node].children.end()) {
+         trie[node].children[c] = trie.size();
+         node = trie.size();
+         trie.emplace_back();
+      } else {
+         node = iter->second;
+      }
+   }
+   trie[node].excluded = true;
+}
+//---------------------------------------------------------------------------
+bool PathFilter::addRule(string_view pattern, bool include)
+// Add a rule
+{
+   Rule rule;
+   if (pattern.substr(0, 6) == "regex:") {
+      rule.regex.emplace(llvm::StringRef(pattern.data() + 6, pattern.size() - 6));
+      string error;
+      if (!rule.regex->isValid(error))
+         return false;
+   } else {
+      pattern = globPatterns.emplace_back(pattern);
+      auto glob = llvm::GlobPattern::create({pattern.data(), pattern.size()});
+      if (!glob) {
+         llvm::consumeError(glob.takeError());
+         return false;
+      }
+      rule.glob = move(*glob);
+   }
+   (include ? includes : excludes).push_back(move(rule));
+   return true;
+}
+//---------------------------------------------------------------------------
+bool PathFilter::accepts(string_view path, string_view projectRoot) const
+// Is a file part of the report?
+{
+   // Walk down the trie, every excluded directory on the way is a prefix of the path
+   if ((trie.size() > 1) && (path.substr(0, projectRoot.size()) == projectRoot)) {
+      unsigned node = 0;
+      for (char c : path.substr(projectRoot.size())) {
+         auto iter = trie[node].children.find(c);
+         if (iter == trie[node].children.end())
+            break;
+         node = iter->second;
+         if (trie[node].excluded)
+            return false;
+      }
+   }
+
+   for (auto& r : excludes)
+      if (r.matches(path))
+         return false;
+   if (includes.empty())
+      return true;
+   for (auto& r : includes)
+      if (r.matches(path))
+         return true;
+   return false;
+}
+//---------------------------------------------------------------------------
 int main(int argc, char** argv) {
    // Interpret the arguments
    string projectRoot;
    vector<string> extraIgnore;
-   vector<string> ignoreDirs;
+   PathFilter pathFilter;
+   unsigned jobs = 1, heatmap = 0, deltaThreshold = 50;
+   string baselineFile, patchFile, traceFile;
+   bool incremental = false, lowMemory = false, binaryExport = false, showStats = false;
 
    bool hasProjectRoot = false;
    vector<string> args;
@@ -654,12 +2803,41 @@ int main(int argc, char** argv) {
          } else if (a.substr(0, 15) == "--exclude-line=") {
             extraIgnore.push_back(a.substr(15));
          } else if (a.substr(0, 14) == "--exclude-dir=") {
-            string dirs = a.substr(14);
-            regex splitRegex(",");
-
-            ignoreDirs = {
-               sregex_token_iterator(dirs.begin(), dirs.end(), splitRegex, -1),
-               sregex_token_iterator()};
+            for (string_view dirs = string_view(a).substr(14); !dirs.empty();) {
+               string_view dir = nextToken(dirs, ',');
+               if (!dir.empty()) pathFilter.excludeDir(dir);
+            }
+         } else if ((a.substr(0, 10) == "--exclude=") || (a.substr(0, 10) == "--include=")) {
+            if (!pathFilter.addRule(string_view(a).substr(10), a[2] == 'i')) {
+               cerr << "invalid pattern in " << a << endl;
+               return 1;
+            }
+         } else if (a.substr(0, 7) == "--jobs=") {
+            jobs = strtoul(a.c_str() + 7, nullptr, 10);
+            if (!jobs)
+               jobs = max(thread::hardware_concurrency(), 1u);
+         } else if (a == "--incremental") {
+            incremental = true;
+         } else if (a == "--low-memory") {
+            lowMemory = true;
+         } else if (a == "--binary-export") {
+            binaryExport = true;
+         } else if (a == "--stats") {
+            showStats = true;
+         } else if (a.substr(0, 8) == "--trace=") {
+            traceFile = a.substr(8);
+         } else if (a.substr(0, 11) == "--baseline=") {
+            baselineFile = a.substr(11);
+         } else if (a.substr(0, 8) == "--patch=") {
+            patchFile = a.substr(8);
+         } else if (a.substr(0, 18) == "--delta-threshold=") {
+            deltaThreshold = strtoul(a.c_str() + 18, nullptr, 10);
+         } else if ((a == "--heatmap") || (a.substr(0, 10) == "--heatmap=")) {
+            heatmap = (a.size() > 10) ? strtoul(a.c_str() + 10, nullptr, 10) : 20;
+            if (!heatmap) {
+               cerr << "invalid option " << a << endl;
+               return 1;
+            }
          } else {
             cerr << "unknown option " << a << endl;
          }
@@ -667,19 +2845,73 @@ int main(int argc, char** argv) {
          args.push_back(argv[index]);
       }
    }
-   if (args.size() != 3) {
-      cerr << "usage: " << argv[0] << " targetDir executable default.prodata" << endl;
+   if (args.size() < 3) {
+      cerr << "usage: " << argv[0] << " targetDir executable... default.profdata" << endl;
+      cerr << "executables can also be listed in a file, one per line, that is passed as @file" << endl;
+      cerr << "instead of default.profdata raw profiles can be given as a .profraw file, a directory, or a glob pattern" << endl;
+      return 1;
+   }
+   if (lowMemory && (incremental || binaryExport)) {
+      cerr << (incremental ? "--incremental" : "--binary-export") << " cannot be combined with --low-memory" << endl;
       return 1;
    }
    string targetDir = args[0];
    if ((!targetDir.empty()) && (targetDir.back() != '/'))
       targetDir += '/';
+   vector<string> objectFiles;
+   for (auto iter = args.begin() + 1, limit = args.end() - 1; iter != limit; ++iter) {
+      if ((*iter)[0] != '@') {
+         objectFiles.push_back(*iter);
+         continue;
+      }
+      MappedFile list(iter->substr(1));
+      if (!list.isOpen()) {
+         cerr << "unable to read " << iter->substr(1) << endl;
+         return 1;
+      }
+      for (string_view content = list.content(); !content.empty();) {
+         string_view name = nextToken(content, '\n');
+         if (!name.empty() && (name.back() == '\r')) name.remove_suffix(1);
+         if (!name.empty()) objectFiles.emplace_back(name);
+      }
+   }
+   if (objectFiles.empty()) {
+      cerr << "no executables given" << endl;
+      return 1;
+   }
+   string profileFile = args.back();
 
-   // Load the coverage
-   auto coverage = loadCoverage(args[1], args[2]);
+   // In patch mode only the files touched by the diff are processed
+   unique_ptr<Patch> patch;
+   if (!patchFile.empty()) {
+      patch = make_unique<Patch>();
+      if (!patch->load(patchFile)) {
+         cerr << "unable to read patch " << patchFile << endl;
+         return 1;
+      }
+   }
+
+   MarkerScanner markerScanner(extraIgnore);
+
+   // Load the coverage, the baseline is loaded concurrently. Both loaders share the threads for merging raw profiles
+   PhaseTimer timer;
+   unique_ptr<llvm::coverage::CoverageMapping> baseline;
+   thread baselineLoader;
+   unsigned loadJobs = jobs;
+   if (!baselineFile.empty()) {
+      loadJobs = max(jobs / 2, 1u);
+      unsigned baselineJobs = max(jobs - loadJobs, 1u);
+      baselineLoader = thread([&, baselineJobs]() { baseline = loadCoverage(objectFiles, baselineFile, findRawProfiles(baselineFile), baselineJobs); });
+   }
+   auto rawProfiles = findRawProfiles(profileFile);
+   auto coverage = loadCoverage(objectFiles, profileFile, rawProfiles, loadJobs);
+   if (baselineLoader.joinable())
+      baselineLoader.join();
    auto files = coverage->getUniqueSourceFiles();
-   string binaryName = args[1];
-   auto timestamp = getFileTimestamp(args[2]);
+   string binaryName = objectFiles.front();
+   if (objectFiles.size() > 1)
+      binaryName += " (and " + to_string(objectFiles.size() - 1) + " more)";
+   auto timestamp = rawProfiles.empty() ? getFileTimestamp({&profileFile, 1}) : getFileTimestamp(rawProfiles);
 
    // Compute the project root
    if (!hasProjectRoot) {
@@ -710,82 +2942,315 @@ int main(int argc, char** argv) {
       }
    }
 
+   // Drop the excluded files before doing any work for them
+   unsigned filteredFiles = 0;
+   if (!pathFilter.empty()) {
+      filteredFiles = files.size();
+      erase_if(files, [&](llvm::StringRef f) { return !pathFilter.accepts({f.data(), f.size()}, projectRoot); });
+      filteredFiles -= files.size();
+   }
+   auto functionRecords = bucketFunctions(*coverage, files);
+   vector<vector<FunctionInfo>> functions(files.size());
+   timer.finish("load");
+
    // Translate all files
+   vector<WorkerStats> workerStats(jobs);
    struct FileInfo {
+      unsigned fileIndex;
       string prettyName, htmlFile;
-      unsigned hitLines, executableLines;
+      CoverageStats stats;
+      vector<HotLine> hotLines;
    };
    vector<FileInfo> fileInfo;
-   CoverageList coverageList;
-   for (auto& f : files) {
-      string prettyName = f.str(), relName = "file";
-      if ((!projectRoot.empty()) && (prettyName.substr(0, projectRoot.size()) == projectRoot)) {
-         bool skip = false;
-
-         if (!ignoreDirs.empty())
-            for (const auto& ignoreDir : ignoreDirs)
-               if (prettyName.substr(projectRoot.size(), ignoreDir.size()) == ignoreDir) {
-                  skip = true;
-                  break;
-               }
+   CoverageList coverageList(files);
 
-         if (skip) continue;
-
-         relName = prettyName.substr(projectRoot.size()) + ".html";
-         prettyName = "[...]/" + prettyName.substr(projectRoot.size());
+   // In incremental mode we skip files that did not change since the last run
+   Manifest previousManifest, manifest;
+   string manifestFile = targetDir + "llvmcov2html.manifest";
+   if (incremental) {
+      string settings = to_string(reportVersion) + '\0' + to_string(heatmap) + '\0' + (baseline ? to_string(deltaThreshold) : "-") + '\0' + binaryName + '\0' + projectRoot;
+      for (auto& e : extraIgnore)
+         settings += '\0' + e;
+      if (patch) {
+         MappedFile patchContent(patchFile);
+         settings += '\0' + to_string(llvm::xxh3_64bits(llvm::StringRef(patchContent.content().data(), patchContent.content().size())));
       }
-      while (prettyName.find("/./") != string::npos) {
-         auto split = prettyName.find("/./");
-         prettyName = prettyName.substr(0, split) + prettyName.substr(split + 3);
+      manifest.settingsHash = llvm::xxh3_64bits(settings);
+      if (!previousManifest.load(manifestFile))
+         previousManifest.entries.clear();
+   }
+
+   {
+      // Every worker collects its own results, they are combined in file order afterwards
+      struct WorkerResult {
+         vector<FileInfo> fileInfo;
+         map<string, Manifest::Entry> manifestEntries;
+      };
+      // The pages are written in the background, the writer drains its queue when leaving the block
+      AsyncWriter writer;
+      RenderContext context{*coverage, baseline.get(), markerScanner, binaryName, timestamp, heatmap, deltaThreshold, writer};
+      WorkStealingPool pool(jobs);
+      vector<WorkerResult> results(jobs);
+      for (unsigned worker = 0; worker < jobs; ++worker) {
+         workerStats[worker].worker = worker;
+         workerStats[worker].trace = !traceFile.empty();
       }
+      unique_ptr<LineListSpool> spool;
+      if (lowMemory)
+         spool = make_unique<LineListSpool>(targetDir, jobs, files.size());
+      pool.run(files.size(), [&](unsigned worker, unsigned index) {
+         auto& f = files[index];
+         auto& result = results[worker];
+         auto& ws = workerStats[worker];
+         const LineSet* patchLines = nullptr;
+         if (patch) {
+            patchLines = patch->find({f.data(), f.size()});
+            if (!patchLines) {
+               ++ws.excluded;
+               return;
+            }
+         }
+         string prettyName = f.str(), relName = "file";
+         if ((!projectRoot.empty()) && (prettyName.substr(0, projectRoot.size()) == projectRoot)) {
+            relName = prettyName.substr(projectRoot.size()) + ".html";
+            prettyName = "[...]/" + prettyName.substr(projectRoot.size());
+         }
+         while (prettyName.find("/./") != string::npos) {
+            auto split = prettyName.find("/./");
+            prettyName = prettyName.substr(0, split) + prettyName.substr(split + 3);
+         }
 
-      replace(relName.begin(), relName.end(), '/', '_');
-      string fileName = targetDir + relName;
-      unsigned hitLines, executableLines;
-      if (!processFile(coverageList, fileName, *coverage, f, extraIgnore, hitLines, executableLines, args[1], timestamp, prettyName))
-         continue;
+         replace(relName.begin(), relName.end(), '/', '_');
+         string fileName = targetDir + relName;
+         functions[index] = collectFunctions(functionRecords[index]);
+         CoverageStats stats;
+         vector<HotLine> hotLines;
+         const Manifest::Entry* previous = nullptr;
+         Manifest::Entry* entry = nullptr;
+         if (incremental) {
+            auto iter = previousManifest.entries.find(f.str());
+            if ((iter != previousManifest.entries.end()) && (previousManifest.settingsHash == manifest.settingsHash))
+               previous = &iter->second;
+            entry = &result.manifestEntries[f.str()];
+            entry->htmlFile = relName;
+            entry->prettyName = prettyName;
+         }
+         uint64_t begin = getMicroseconds();
+         bool rendered = processFile(context, f, fileName, prettyName, functions[index], patchLines, previous, entry, coverageList[index], stats, hotLines, ws);
+         if (ws.trace)
+            ws.events.push_back({prettyName, worker, begin, getMicroseconds() - begin});
+         if (!rendered) {
+            ++ws.noCoverage;
+            return;
+         }
+
+         // In low memory mode the lines go to disk right away
+         if (spool) {
+            spool->add(worker, index, {f.data(), f.size()}, coverageList[index]);
+            coverageList[index] = {};
+         }
+
+         result.fileInfo.push_back({index, prettyName, relName, stats, move(hotLines)});
+      });
 
-      fileInfo.push_back({prettyName, relName, hitLines, executableLines});
+      for (auto& r : results) {
+         manifest.entries.merge(r.manifestEntries);
+         move(r.fileInfo.begin(), r.fileInfo.end(), back_inserter(fileInfo));
+      }
+      sort(fileInfo.begin(), fileInfo.end(), [](const FileInfo& a, const FileInfo& b) { return a.fileIndex < b.fileIndex; });
+      if (spool)
+         spool->finish();
    }
+   double renderTime = timer.finish("render");
    sort(fileInfo.begin(), fileInfo.end(), [](const FileInfo& a, const FileInfo& b) {
-      unsigned perc1 = computePerc(a.hitLines, a.executableLines);
-      unsigned perc2 = computePerc(b.hitLines, b.executableLines);
+      unsigned perc1 = computePerc(a.stats.hitLines, a.stats.executableLines);
+      unsigned perc2 = computePerc(b.stats.hitLines, b.stats.executableLines);
       if (perc1 != perc2)
          return perc1 < perc2;
       return a.prettyName < b.prettyName;
    });
 
+   // In heatmap mode the hottest lines and functions of the whole report are collected
+   vector<HotLineRow> hotLineRows;
+   vector<FunctionRow> hotFunctionRows;
+   if (heatmap) {
+      vector<FunctionRow> functionRows;
+      for (auto& i : fileInfo) {
+         string_view path(files[i.fileIndex].data(), files[i.fileIndex].size());
+         for (auto& h : i.hotLines)
+            hotLineRows.push_back({h, i.htmlFile, i.prettyName, path});
+         for (auto& f : functions[i.fileIndex])
+            functionRows.push_back({&f, i.htmlFile, i.prettyName, path});
+      }
+      sort(hotLineRows.begin(), hotLineRows.end(), [](const HotLineRow& a, const HotLineRow& b) {
+         if (a.hotLine.count != b.hotLine.count)
+            return a.hotLine.count > b.hotLine.count;
+         if (a.prettyName != b.prettyName)
+            return a.prettyName < b.prettyName;
+         return a.hotLine.line < b.hotLine.line;
+      });
+      if (hotLineRows.size() > heatmap)
+         hotLineRows.resize(heatmap);
+      hotFunctionRows = getHotFunctions(functionRows, heatmap);
+   }
+
+   // Group the files by directory, every directory is the parent of its subdirectories
+   struct DirectoryInfo {
+      string path, name, htmlFile;
+      unsigned parent;
+      CoverageStats stats;
+      vector<unsigned> subdirs, files;
+   };
+   vector<DirectoryInfo> directories;
+   {
+      unordered_map<string, unsigned> directoryLookup;
+      auto getDirectory = [&](auto& self, const string& path) -> unsigned {
+         if (auto iter = directoryLookup.find(path); iter != directoryLookup.end())
+            return iter->second;
+         unsigned parent = 0;
+         string name, htmlFile = "index.html";
+         if (!path.empty()) {
+            // Absolute paths outside of the project root are grouped below "/"
+            auto pos = (path.size() > 1) ? path.rfind('/', path.size() - 2) : string::npos;
+            parent = self(self, (pos == string::npos) ? string() : path.substr(0, pos + 1));
+            name = (path.size() > 1) ? path.substr(pos + 1, path.size() - pos - 2) : path;
+            // Slashes become '_', thus '_' and the escape character '~' itself are escaped to keep the names of a_b/ and a/b/ apart
+            htmlFile = "index_";
+            for (char c : string_view(path).substr(0, path.size() - 1)) {
+               if ((c == '_') || (c == '~')) htmlFile += '~';
+               htmlFile += (c == '/') ? '_' : c;
+            }
+            htmlFile += ".html";
+         } else {
+            name = projectRoot.empty() ? "top level" : "[...]";
+         }
+         unsigned index = directories.size();
+         directories.push_back({path, move(name), move(htmlFile), parent, {}, {}, {}});
+         if (!path.empty())
+            directories[parent].subdirs.push_back(index);
+         directoryLookup[path] = index;
+         return index;
+      };
+      getDirectory(getDirectory, "");
+      for (unsigned index = 0; index < fileInfo.size(); ++index) {
+         string_view name = fileInfo[index].prettyName;
+         if (name.substr(0, 6) == "[...]/") name.remove_prefix(6);
+         directories[getDirectory(getDirectory, string(name.substr(0, name.rfind('/') + 1)))].files.push_back(index);
+      }
+
+      // Parents are created before their subdirectories, a single backwards pass aggregates the coverage bottom-up
+      for (auto& d : directories)
+         for (auto f : d.files)
+            d.stats += fileInfo[f].stats;
+      for (unsigned index = directories.size() - 1; index > 0; --index)
+         directories[directories[index].parent].stats += directories[index].stats;
+      for (auto& d : directories)
+         sort(d.subdirs.begin(), d.subdirs.end(), [&](unsigned a, unsigned b) {
+            unsigned perc1 = computePerc(directories[a].stats.hitLines, directories[a].stats.executableLines);
+            unsigned perc2 = computePerc(directories[b].stats.hitLines, directories[b].stats.executableLines);
+            if (perc1 != perc2)
+               return perc1 < perc2;
+            return directories[a].path < directories[b].path;
+         });
+   }
+
+   // Remove the pages of files and directories that vanished or are excluded since the last run. Page names never contain a '/', anything else is not ours to delete
+   if (incremental) {
+      vector<string_view> pages;
+      for (auto& e : manifest.entries)
+         pages.push_back(e.second.htmlFile);
+      for (auto& d : directories)
+         pages.push_back(d.htmlFile);
+      sort(pages.begin(), pages.end());
+      auto isStale = [&](string_view page) { return (page.find('/') == string_view::npos) && (!binary_search(pages.begin(), pages.end(), page)); };
+      for (auto& e : previousManifest.entries)
+         if (isStale(e.second.htmlFile))
+            unlink((targetDir + e.second.htmlFile).c_str());
+      if (DIR* dir = opendir(targetDir.c_str())) {
+         while (auto entry = readdir(dir)) {
+            string_view name = entry->d_name;
+            if (name.starts_with("index_") && name.ends_with(".html") && isStale(name))
+               unlinkat(dirfd(dir), entry->d_name, 0);
+         }
+         closedir(dir);
+      }
+   }
+
    // Write the summary
    {
-      ofstream out(targetDir + "index.html");
-      unsigned hitLines = 0, executableLines = 0;
-      for (auto& i : fileInfo) {
-         hitLines += i.hitLines;
-         executableLines += i.executableLines;
+      auto& stats = directories.front().stats;
+      cout << "coverage: " << computePerc(stats.hitLines, stats.executableLines) / 10.0 << "%, " << (stats.executableLines - stats.hitLines) << " lines not reached" << endl;
+      if (baseline)
+         cout << "baseline: " << computePerc(stats.baselineHitLines, stats.baselineExecutableLines) / 10.0 << "%, " << stats.newlyCovered << " lines newly covered, " << stats.newlyUncovered << " lines no longer covered" << endl;
+      if (patch)
+         cout << "patch coverage: " << computePerc(stats.patchHitLines, stats.patchExecutableLines) / 10.0 << "%, " << (stats.patchExecutableLines - stats.patchHitLines) << " changed lines not reached" << endl;
+   }
+   bool hasFunctions = any_of(fileInfo.begin(), fileInfo.end(), [&](const FileInfo& i) { return !functions[i.fileIndex].empty(); });
+   for (auto& d : directories) {
+      OutputFile out(targetDir + d.htmlFile);
+      string prettyDirectory;
+      if (!d.path.empty())
+         prettyDirectory = (projectRoot.empty() || (d.path.front() == '/')) ? d.path : ("[...]/" + d.path);
+      writeHeader(out, binaryName, timestamp, prettyDirectory, d.stats, !!baseline, !!patch, true);
+
+      // The path of the directory links to all parents
+      if (!d.path.empty()) {
+         vector<const DirectoryInfo*> parents;
+         for (auto p = &directories[d.parent];; p = &directories[p->parent]) {
+            parents.push_back(p);
+            if (p->path.empty()) break;
+         }
+         out << "<center>";
+         for (auto iter = parents.rbegin(); iter != parents.rend(); ++iter) {
+            out << "<a href=\"" << (*iter)->htmlFile << "\">";
+            escapeHtml(out, (*iter)->name);
+            out << "</a>&nbsp;/&nbsp;";
+         }
+         escapeHtml(out, d.name);
+         out << "</center><br/>\n";
+      } else {
+         out << R"(<center><a href="files.html">All files</a>)" << (hasFunctions ? R"(&nbsp;&nbsp;<a href="functions.html">All functions</a>)" : "") << "</center><br/>\n";
       }
-      writeHeader(out, binaryName, timestamp, "", hitLines, executableLines, true);
-      cout << "coverage: " << computePerc(hitLines, executableLines) / 10.0 << "%, " << (executableLines - hitLines) << " lines not reached" << endl;
 
+      // The columns are the same on all pages
+      auto& totals = directories.front().stats;
       out << R"(<center>
                   <table id="main" width="80%" cellpadding="2" cellspacing="1" border="0">
                     <tr>
                       <td width="50%"><br/></td>
                       <td width="15%"></td>
                       <td width="15%"></td>
-                      <td width="20%"></td>
+                      <td width="20%"></td>)"
+          << (totals.branches ? R"(<td width="15%"></td>)" : "") << (totals.conditions ? R"(<td width="15%"></td>)" : "") << (baseline ? R"(<td width="15%"></td>)" : "") << (patch ? R"(<td width="15%"></td>)" : "") << R"(
                    </tr>
                  <tr>
                    <td class="tableHead">File</td>
-                   <td class="tableHead" colspan="3">Coverage</td>
-                 </tr>)"
-          << endl;
-      for (auto& i : fileInfo) {
-         unsigned perc = computePerc(i.hitLines, i.executableLines);
-         const char* qc = (perc >= 750) ? "Hi" : ((perc >= 350) ? "Med" : "Lo");
+                   <td class="tableHead" colspan="3">Coverage</td>)"
+          << (totals.branches ? R"(<td class="tableHead">Branches</td>)" : "") << (totals.conditions ? R"(<td class="tableHead">MC/DC</td>)" : "") << (baseline ? R"(<td class="tableHead">Change</td>)" : "") << (patch ? R"(<td class="tableHead">Patch</td>)" : "") << R"(
+                 </tr>
+)";
+      auto getQualityClass = [](unsigned perc) { return (perc >= 750) ? "Hi" : ((perc >= 350) ? "Med" : "Lo"); };
+      auto writeCount = [&](unsigned hit, unsigned total) {
+         if (!total) {
+            out << R"(<td class="coverBar"></td>)";
+            return;
+         }
+         unsigned perc = computePerc(hit, total);
+         out << R"(<td class="cover)" << getQualityClass(perc) << "\">" << formatPerc(perc) << "&nbsp;%&nbsp;(" << hit << "&nbsp;/&nbsp;" << total << ")</td>";
+      };
+      auto writeEntry = [&](const string& htmlFile, string_view name, bool isDirectory, const CoverageStats& stats) {
+         unsigned perc = computePerc(stats.hitLines, stats.executableLines);
+         const char* qc = getQualityClass(perc);
          out << R"(<tr>
                      <td class="coverFile"><a href=")"
-             << i.htmlFile << "\">";
-         highlightFilename(out, i.prettyName);
+             << htmlFile << "\">";
+         if (isDirectory) {
+            out << "<span class=\"filename\">";
+            escapeHtml(out, name);
+            out << "</span>";
+         } else {
+            highlightFilename(out, name);
+         }
          out << R"(</a></td>
                      <td class="coverBar" align="center">
                        <table border="0" cellspacing="0" cellpadding="1"><tr><td>)";
@@ -793,32 +3258,180 @@ int main(int argc, char** argv) {
          out << R"(</td></tr></table>
                      </td>
                      <td class="coverPer cover)"
-             << qc << "\">" << (perc / 10) << "." << (perc % 10) << R"(&nbsp;%</td>
+             << qc << "\">" << formatPerc(perc) << R"(&nbsp;%</td>
                      <td class="cover)"
-             << qc << "\">" << i.hitLines << "&nbsp;/&nbsp;" << i.executableLines << R"(&nbsp;lines</td>
-                   </tr>)"
-             << endl;
+             << qc << "\">" << stats.hitLines << "&nbsp;/&nbsp;" << stats.executableLines << R"(&nbsp;lines</td>)";
+         if (totals.branches)
+            writeCount(stats.hitBranches, stats.branches);
+         if (totals.conditions)
+            writeCount(stats.coveredConditions, stats.conditions);
+         if (baseline) {
+            int change = static_cast<int>(perc) - static_cast<int>(computePerc(stats.baselineHitLines, stats.baselineExecutableLines));
+            out << R"(<td class="coverNum">)" << ((change < 0) ? '-' : '+') << formatPerc(abs(change)) << "&nbsp;%&nbsp;(+" << stats.newlyCovered << "&nbsp;/&nbsp;-" << stats.newlyUncovered << ")</td>";
+         }
+         if (patch)
+            writeCount(stats.patchHitLines, stats.patchExecutableLines);
+         out << R"(
+                   </tr>
+)";
+      };
+      for (auto s : d.subdirs)
+         writeEntry(directories[s].htmlFile, (directories[s].path == "/") ? "/" : directories[s].name + '/', true, directories[s].stats);
+      for (auto f : d.files) {
+         auto& i = fileInfo[f];
+         writeEntry(i.htmlFile, string_view(i.prettyName).substr(i.prettyName.rfind('/') + 1), false, i.stats);
+      }
+      out << "  </table>\n"
+          << "</center>\n"
+          << "<br/>\n";
+      if (heatmap && d.path.empty()) {
+         writeHotLineTable(out, hotLineRows, true, "Hottest lines");
+         writeFunctionTable(out, hotFunctionRows, true, "Hottest functions");
       }
-      out << "  </table>" << endl
-          << "</center>" << endl
-          << "<br/>" << endl;
 
-      writeFooter(out, true);
+      writeFooter(out, false);
+      out.close();
    }
+
+   // Write the list of all files. The rows are data for the table in files.html, which only creates the visible rows. The
+   // search index contains the lower-case names, separated by line breaks
    {
-      ofstream out(targetDir + "hits");
-      for (auto& c : coverageList)
-         for (auto l : c.second.hits)
-            out << c.first << ":" << l << endl;
+      OutputFile out(targetDir + "filelist.js");
+      auto& totals = directories.front().stats;
+      out << "var llvmcov2htmlFiles = {\"branches\": " << (totals.branches ? "true" : "false") << ", \"conditions\": " << (totals.conditions ? "true" : "false") << ", \"baseline\": " << (baseline ? "true" : "false") << ", \"patch\": " << (patch ? "true" : "false") << ",\n\"files\": [";
+      string searchIndex;
+      bool first = true;
+      for (auto& i : fileInfo) {
+         auto& st = i.stats;
+         out << (first ? "\n[" : ",\n[");
+         writeJsonString(out, i.prettyName);
+         out << ',';
+         writeJsonString(out, i.htmlFile);
+         out << ',' << st.hitLines << ',' << st.executableLines << ',' << st.hitBranches << ',' << st.branches << ',' << st.coveredConditions << ',' << st.conditions << ',' << st.baselineHitLines << ',' << st.baselineExecutableLines << ',' << st.newlyCovered << ',' << st.newlyUncovered << ',' << st.patchHitLines << ',' << st.patchExecutableLines << ']';
+         for (char c : i.prettyName)
+            searchIndex += ((c >= 'A') && (c <= 'Z')) ? static_cast<char>(c - 'A' + 'a') : c;
+         searchIndex += '\n';
+         first = false;
+      }
+      out << "],\n\"search\": ";
+      writeJsonString(out, searchIndex);
+      out << "};\n";
+      out.close();
+   }
+   {
+      OutputFile out(targetDir + "files.html");
+      writeHeader(out, binaryName, timestamp, "Files", directories.front().stats, !!baseline, !!patch, true);
+      out << R"(<center><a href="index.html">Directories</a></center><br/>
+<center>
+  <div id="fileList" class="fileList">
+    <table width="100%" cellpadding="2" cellspacing="0" border="0"></table>
+  </div>
+</center>
+<br/>
+)";
+      writeFooter(out, true);
+      out.close();
    }
+
+   // Write the functions of all files, the least called ones first
    {
-      ofstream out(targetDir + "notreached");
-      for (auto& c : coverageList)
-         for (auto l : c.second.misses)
-            out << c.first << ":" << l << endl;
+      vector<FunctionRow> rows;
+      CoverageStats stats;
+      for (auto& i : fileInfo) {
+         stats += i.stats;
+         for (auto& f : functions[i.fileIndex])
+            rows.push_back({&f, i.htmlFile, i.prettyName, {}});
+      }
+      if (!rows.empty()) {
+         sort(rows.begin(), rows.end(), [](const FunctionRow& a, const FunctionRow& b) {
+            if (a.function->executionCount != b.function->executionCount)
+               return a.function->executionCount < b.function->executionCount;
+            if (a.prettyName != b.prettyName)
+               return a.prettyName < b.prettyName;
+            return a.function->line < b.function->line;
+         });
+         OutputFile out(targetDir + "functions.html");
+         writeHeader(out, binaryName, timestamp, "Functions", stats, !!baseline, !!patch, false);
+         writeFunctionTable(out, rows, true);
+         writeFooter(out, false);
+         out.close();
+      }
+   }
+   timer.finish("index");
+   if (heatmap) {
+      OutputFile out(targetDir + "hot.json");
+      out << "{\n   \"lines\": [";
+      bool first = true;
+      for (auto& r : hotLineRows) {
+         out << (first ? "\n      " : ",\n      ") << R"({"file": )";
+         writeJsonString(out, r.path);
+         out << R"(, "line": )" << r.hotLine.line << R"(, "count": )" << r.hotLine.count << '}';
+         first = false;
+      }
+      out << "\n   ],\n   \"functions\": [";
+      first = true;
+      for (auto& r : hotFunctionRows) {
+         out << (first ? "\n      " : ",\n      ") << R"({"file": )";
+         writeJsonString(out, r.path);
+         out << R"(, "function": )";
+         writeJsonString(out, r.function->name);
+         out << R"(, "line": )" << r.function->line << R"(, "count": )" << r.function->executionCount << R"(, "coveredRegions": )" << r.function->coveredRegions << R"(, "regions": )" << r.function->regions << '}';
+         first = false;
+      }
+      out << "\n   ]\n}\n";
+      out.close();
+   }
+   if (incremental)
+      manifest.write(manifestFile, coverageList);
+   if (!lowMemory) {
+      OutputFile out(targetDir + "hits");
+      coverageList.write(out, &HitList::hits);
+      out.close();
+   }
+   if (!lowMemory) {
+      OutputFile out(targetDir + "notreached");
+      coverageList.write(out, &HitList::misses);
+      out.close();
+   }
+   if (binaryExport) {
+      OutputFile out(targetDir + "coverage.bin");
+      coverageList.writeBinary(out);
+      out.close();
    }
 
    // Write extra files
    writeExtras(targetDir);
+   timer.finish("extras");
+
+   if (lowMemory)
+      cout << "peak memory: " << (getPeakMemory() >> 20) << " MB" << endl;
+   if (showStats) {
+      WorkerStats total;
+      total.excluded = filteredFiles;
+      for (auto& ws : workerStats) {
+         total.rendered += ws.rendered;
+         total.unchanged += ws.unchanged;
+         total.excluded += ws.excluded;
+         total.noCoverage += ws.noCoverage;
+         total.lines += ws.lines;
+         total.fragments += ws.fragments;
+         total.queryTime += ws.queryTime;
+         total.computeTime += ws.computeTime;
+         total.emitTime += ws.emitTime;
+      }
+      timer.print(cerr);
+      cerr << "render steps (summed over workers): query " << (total.queryTime / 1e6) << " s, compute " << (total.computeTime / 1e6) << " s, emit " << (total.emitTime / 1e6) << " s\n";
+      cerr << "files: " << (files.size() + filteredFiles) << " total, " << total.rendered << " rendered, " << total.unchanged << " unchanged, " << total.excluded << " excluded, " << total.noCoverage << " without coverage\n";
+      cerr << "lines: " << total.lines << " lines, " << total.fragments << " fragments, " << static_cast<uint64_t>(total.lines / max(renderTime, 1e-9)) << " lines/s\n";
+      cerr << "written: " << OutputFile::totalWritten << " bytes, " << (AsyncWriter::totalWriteTime / 1e6) << " s in the background writer\n";
+      cerr << "peak memory: " << (getPeakMemory() >> 20) << " MB" << endl;
+   }
+   if (!traceFile.empty()) {
+      vector<TraceEvent> events;
+      timer.addEvents(events);
+      for (auto& ws : workerStats)
+         move(ws.events.begin(), ws.events.end(), back_inserter(events));
+      writeTrace(traceFile, events, jobs);
+   }
 }
 //---------------------------------------------------------------------------
@@ -0,0 +1,114 @@
+#!/usr/bin/env bash
+# Benchmark one or more llvmcov2html binaries on a large generated project.
+# Reports the best runtime, the per-phase timing of --stats (where the binary supports it)
+# and, if strace is available, the number of write syscalls.
+#
+# usage: test/bench.sh [binary...]        (default: bin/llvmcov2html)
+# The scale is controlled by
+#    FILES       the number of generated source files (default: 50)
+#    FUNCTIONS   the number of functions per file (default: 400)
+#    DIRS        the number of directories the files are spread over (default: 5)
+#    ARGS        extra arguments for llvmcov2html, e.g. ARGS="--jobs=0 --heatmap"
+#    REPEAT      the number of timed runs per binary, the fastest one is reported (default: 1)
+#    BASELINE    a git revision that is built and benchmarked before the given binaries,
+#                e.g. BASELINE=HEAD~1 to compare the working tree against the previous commit
+set -euo pipefail
+
+LLVM_VERSION=21
+LLVM_CONFIG=$(command -v llvm-config-$LLVM_VERSION || command -v llvm-config)
+LLVM_BINDIR=$(eval $LLVM_CONFIG --bindir)
+LLVM_PROFDATA=$(command -v llvm-profdata-$LLVM_VERSION || command -v $LLVM_BINDIR/llvm-profdata || command -v llvm-profdata) || { echo "need llvm-profdata"; exit 1; }
+CLANG=$(command -v clang++-$LLVM_VERSION || command -v $LLVM_BINDIR/clang++ || command -v clang++) || { echo "need clang++"; exit 1; }
+STRACE=$(command -v strace || true)
+
+FILES=${FILES:-50}
+FUNCTIONS=${FUNCTIONS:-400}
+DIRS=${DIRS:-5}
+REPEAT=${REPEAT:-1}
+read -r -a EXTRA_ARGS <<< "${ARGS:-}"
+BINARIES=("$@")
+[ ${#BINARIES[@]} -eq 0 ] && BINARIES=(bin/llvmcov2html)
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# Build the baseline revision from a clean export of the repository
+if [ -n "${BASELINE:-}" ]; then
+   mkdir -p "$WORK/baseline"
+   git -C "$(dirname "$0")" archive "$BASELINE" | tar -x -C "$WORK/baseline"
+   make -C "$WORK/baseline" -s bin/llvmcov2html
+   BINARIES=("$WORK/baseline/bin/llvmcov2html" "${BINARIES[@]}")
+fi
+
+# Generate the project, every function has a partially covered branch and every third function is called
+SOURCES=()
+for ((f = 0; f < FILES; f++)); do
+   mkdir -p "$WORK/src/dir$((f % DIRS))"
+   file="$WORK/src/dir$((f % DIRS))/file$f.cpp"
+   SOURCES+=("$file")
+   {
+      for ((i = 0; i < FUNCTIONS; i++)); do
+         echo "int f${f}_$i(int x) {"
+         echo "   if (x > $((i % 7)) && x < 100) {"
+         echo "      x += $i;"
+         echo "   } else {"
+         echo "      x -= 1;"
+         echo "   }"
+         echo "   return x;"
+         echo "}"
+      done
+      echo "int run$f(int x) {"
+      echo "   int s = 0;"
+      for ((i = 0; i < FUNCTIONS; i += 3)); do
+         echo "   s += f${f}_$i(x);"
+      done
+      echo "   return s;"
+      echo "}"
+   } > "$file"
+done
+{
+   for ((f = 0; f < FILES; f++)); do
+      echo "int run$f(int x);"
+   done
+   echo "int main(int argc, char**) {"
+   echo "   int s = 0;"
+   for ((f = 0; f < FILES; f++)); do
+      echo "   s += run$f(argc);"
+   done
+   echo "   return s & 1;"
+   echo "}"
+} > "$WORK/src/main.cpp"
+echo "generated $((FILES * FUNCTIONS)) functions in $FILES files, $(cat "${SOURCES[@]}" | wc -l) lines"
+
+"$CLANG" -O0 -fprofile-instr-generate -fcoverage-mapping "$WORK/src/main.cpp" "${SOURCES[@]}" -o "$WORK/large"
+LLVM_PROFILE_FILE="$WORK/large.profraw" "$WORK/large" || true
+"$LLVM_PROFDATA" merge -sparse "$WORK/large.profraw" -o "$WORK/large.profdata"
+
+for bin in "${BINARIES[@]}"; do
+   echo "== $bin"
+   # Older revisions have no --stats
+   STATS=()
+   grep -qa -- "--stats" "$bin" && STATS=(--stats)
+   best=
+   for ((r = 0; r < REPEAT; r++)); do
+      rm -rf "$WORK/out" && mkdir -p "$WORK/out"
+      start=$(date +%s.%N)
+      if [ $r -eq 0 ]; then
+         "$bin" "${STATS[@]}" "${EXTRA_ARGS[@]}" "$WORK/out" "$WORK/large" "$WORK/large.profdata"
+      else
+         "$bin" "${EXTRA_ARGS[@]}" "$WORK/out" "$WORK/large" "$WORK/large.profdata" > /dev/null
+      fi
+      end=$(date +%s.%N)
+      elapsed=$(awk "BEGIN { print $end - $start }")
+      if [ -z "$best" ] || awk "BEGIN { exit !($elapsed < $best) }"; then
+         best=$elapsed
+      fi
+   done
+   echo "time: $best s (best of $REPEAT)"
+   # Count the syscalls in a separate run, strace distorts the timing
+   if [ -n "$STRACE" ]; then
+      rm -rf "$WORK/out" && mkdir -p "$WORK/out"
+      "$STRACE" -f -c -e trace=write,writev,pwrite64 -o "$WORK/strace.txt" "$bin" "${EXTRA_ARGS[@]}" "$WORK/out" "$WORK/large" "$WORK/large.profdata" > /dev/null
+      awk '$NF ~ /^(write|writev|pwrite64)$/ { print "syscalls " $NF ": " $4 }' "$WORK/strace.txt"
+   fi
+done
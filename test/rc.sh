@@ -1,7 +1,7 @@
 #!/usr/bin/env bash
 set -euo pipefail
 
-LLVM_VERSION=11
+LLVM_VERSION=21
 LLVM_CONFIG=$(command -v llvm-config-$LLVM_VERSION || command -v llvm-config)
 LLVM_BINDIR=$(eval $LLVM_CONFIG --bindir)
 LLVM_PROFDATA=$(command -v llvm-profdata-$LLVM_VERSION || command -v $LLVM_BINDIR/llvm-profdata || command -v llvm-profdata) || { echo "need llvm-profdata"; exit 1; }
@@ -14,3 +14,71 @@ LLVM_PROFILE_FILE="rc.profraw" test/switch
 
 mkdir -p tmp
 bin/llvmcov2html tmp test/switch rc.profdata
+
+# The output must not depend on the number of worker threads
+rm -rf tmp_j1 tmp_j4
+mkdir -p tmp_j1 tmp_j4
+indexed_output=$(bin/llvmcov2html --jobs=1 tmp_j1 test/switch rc.profdata)
+bin/llvmcov2html --jobs=4 tmp_j4 test/switch rc.profdata
+diff -r tmp_j1 tmp_j4
+
+# Raw profiles are merged in memory and must give the same report as the indexed profile. Only the date differs, it is taken from the profile
+check_raw() {
+   local profile=$1 expected_dir=$2 expected_output=$3
+   local output
+   rm -rf tmp2 && mkdir -p tmp2
+   output=$(bin/llvmcov2html --jobs=2 tmp2 test/switch "$profile")
+   if [ "$output" != "$expected_output" ]; then
+      echo "raw profile $profile: expected '$expected_output', got '$output'"
+      exit 1
+   fi
+   diff -r -I '^ *<td class="headerValue" width="15%">[A-Z][a-z][a-z] ' "$expected_dir" tmp2
+}
+check_raw rc.profraw tmp_j1 "$indexed_output"
+rm -rf rc-profiles tmp_merged
+mkdir -p rc-profiles tmp_merged
+cp rc.profraw rc-profiles/rc-1.profraw
+LLVM_PROFILE_FILE="rc-profiles/rc-2.profraw" test/switch extra
+"$LLVM_PROFDATA" merge -sparse rc-profiles/*.profraw -o rc-merged.profdata
+merged_output=$(bin/llvmcov2html --jobs=1 tmp_merged test/switch rc-merged.profdata)
+check_raw rc-profiles tmp_merged "$merged_output"
+check_raw 'rc-profiles/*.profraw' tmp_merged "$merged_output"
+
+# The binary export must agree with the coverage of test/switch when run without arguments
+bin/llvmcov2html --binary-export tmp test/switch rc.profdata
+check_query() {
+   local expected_code=$1 expected=$2 query=$3
+   local output code=0
+   output=$(bin/covquery tmp/coverage.bin "$query" 2>/dev/null) || code=$?
+   if [ "$code" -ne "$expected_code" ] || { [ -n "$expected" ] && [ "$output" != "$query $expected" ]; }; then
+      echo "covquery $query: expected '$expected' with exit code $expected_code, got '$output' with exit code $code"
+      exit 1
+   fi
+}
+check_query 0 "hit" switch.cpp:3
+check_query 0 "hit" test/switch.cpp:4
+check_query 1 "missed" switch.cpp:5
+check_query 1 "not executable" switch.cpp:1
+check_query 1 "unknown file" other.cpp:3
+check_query 1 "unknown line" switch.cpp:9999
+check_query 1 "unknown line" switch.cpp:0
+check_query 2 "" switch.cpp:x
+check_query 2 "" switch.cpp:
+
+# The patch adds lines 4 (hit) and 5 (missed) to test/switch.cpp and deletes another file
+patch_output=$(bin/llvmcov2html --patch=test/switch.diff tmp test/switch rc.profdata)
+if ! grep -q "^patch coverage: 50%, 1 changed lines not reached$" <<< "$patch_output"; then
+   echo "unexpected patch coverage: $patch_output"
+   exit 1
+fi
+changed=$(grep -o 'class="lineNumChanged"[^>]*>[ 0-9]*' tmp/*switch.cpp.html | grep -o '[0-9]*$' | tr '\n' ' ')
+if [ "$changed" != "4 5 " ]; then
+   echo "unexpected changed lines: $changed"
+   exit 1
+fi
+
+# A hunk with more added lines than its header announces must be rejected
+if bin/llvmcov2html --patch=test/malformed.diff tmp test/switch rc.profdata 2>/dev/null; then
+   echo "malformed patch was accepted"
+   exit 1
+fi